@@ -0,0 +1,170 @@
+#include "arena.h"
+#include "thread.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define ARENA_ALIGN 16
+
+static volatile long heapAllocs = 0;
+
+static void* heapAlloc(size_t bytes)
+{
+	thr_atomicAdd(&heapAllocs, 1);
+	return malloc(bytes);
+}
+
+long arena_heapAllocs()
+{
+	return thr_atomicAdd(&heapAllocs, 0);
+}
+
+
+void* arena_alloc(Arena* arena, size_t bytes)
+{
+	bytes = (bytes + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+	arena->needed += bytes;
+
+	if (arena->used + bytes <= arena->size)
+	{
+		void* ptr = arena->base + arena->used;
+		arena->used += bytes;
+		return ptr;
+	}
+
+	// Chained through the first ARENA_ALIGN bytes, keeps the data aligned
+	uint8_t* block = heapAlloc(bytes + ARENA_ALIGN);
+	if (!block)
+		return NULL;
+	*(void**)block = arena->overflow;
+	arena->overflow = block;
+
+	return block + ARENA_ALIGN;
+}
+
+void* arena_calloc(Arena* arena, size_t count, size_t size)
+{
+	void* ptr = arena_alloc(arena, count * size);
+	if (ptr)
+		memset(ptr, 0, count * size);
+	return ptr;
+}
+
+void arena_reset(Arena* arena)
+{
+	while (arena->overflow)
+	{
+		void* next = *(void**)arena->overflow;
+		free(arena->overflow);
+		arena->overflow = next;
+	}
+
+	if (arena->needed > arena->size)
+	{
+		free(arena->base);
+		arena->base = heapAlloc(arena->needed);
+		arena->size = arena->base ? arena->needed : 0;
+	}
+
+	arena->used = 0;
+	arena->needed = 0;
+}
+
+void arena_free(Arena* arena)
+{
+	arena_reset(arena);
+	free(arena->base);
+	memset(arena, 0, sizeof(Arena));
+}
+
+
+#define POOL_MIN_CLASS 8
+#define POOL_CLASSES 32
+
+static void* poolFree[POOL_CLASSES];
+static Mutex poolMutex = MUTEX_INIT;
+static size_t poolLive;   // bytes handed out
+static size_t poolCached; // bytes waiting in poolFree
+
+static int poolClass(size_t bytes)
+{
+	int sizeClass = POOL_MIN_CLASS;
+	while (((size_t)1 << sizeClass) < bytes)
+		sizeClass++;
+	return sizeClass;
+}
+
+void* pool_alloc(size_t bytes)
+{
+	int sizeClass = poolClass(bytes);
+	if (sizeClass >= POOL_CLASSES)
+		return NULL;
+
+	size_t classBytes = (size_t)1 << sizeClass;
+	thr_mutexLock(&poolMutex);
+	void* block = poolFree[sizeClass];
+	if (block)
+	{
+		poolFree[sizeClass] = *(void**)block;
+		poolCached -= classBytes;
+	}
+	thr_mutexUnlock(&poolMutex);
+
+	if (!block)
+		block = heapAlloc(classBytes);
+
+	if (block)
+	{
+		thr_mutexLock(&poolMutex);
+		poolLive += classBytes;
+		thr_mutexUnlock(&poolMutex);
+	}
+	return block;
+}
+
+void pool_free(void* block, size_t bytes)
+{
+	if (!block)
+		return;
+
+	int sizeClass = poolClass(bytes);
+
+	size_t classBytes = (size_t)1 << sizeClass;
+	thr_mutexLock(&poolMutex);
+	*(void**)block = poolFree[sizeClass];
+	poolFree[sizeClass] = block;
+	poolLive -= classBytes;
+	poolCached += classBytes;
+	thr_mutexUnlock(&poolMutex);
+}
+
+size_t pool_liveBytes()
+{
+	thr_mutexLock(&poolMutex);
+	size_t bytes = poolLive;
+	thr_mutexUnlock(&poolMutex);
+	return bytes;
+}
+
+size_t pool_cachedBytes()
+{
+	thr_mutexLock(&poolMutex);
+	size_t bytes = poolCached;
+	thr_mutexUnlock(&poolMutex);
+	return bytes;
+}
+
+void pool_trim(size_t keepBytes)
+{
+	// Largest classes first, they free the most for the fewest calls
+	thr_mutexLock(&poolMutex);
+	for (int sizeClass = POOL_CLASSES - 1; sizeClass >= POOL_MIN_CLASS && poolCached > keepBytes; sizeClass--)
+		while (poolFree[sizeClass] && poolCached > keepBytes)
+		{
+			void* block = poolFree[sizeClass];
+			poolFree[sizeClass] = *(void**)block;
+			poolCached -= (size_t)1 << sizeClass;
+			free(block);
+		}
+	thr_mutexUnlock(&poolMutex);
+}
\ No newline at end of file
@@ -0,0 +1,34 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+// Scratch memory for one worker thread
+// Allocations live until the next arena_reset. If a build needed more
+// than the arena holds, the reset grows it to fit, so once every worker has
+// seen the largest chunk, building never touches the heap again
+typedef struct Arena
+{
+	uint8_t* base;
+	size_t size;
+	size_t used;
+	size_t needed;   // bytes asked for since the last reset
+	void* overflow;  // one-off blocks taken while base was full
+} Arena;
+
+void* arena_alloc(Arena* arena, size_t bytes);
+void* arena_calloc(Arena* arena, size_t count, size_t size);
+void arena_reset(Arena* arena);
+void arena_free(Arena* arena);
+
+// Recycled blocks for meshes that outlive a build, in power of two classes
+// Freed blocks go back to their class instead of the heap
+void* pool_alloc(size_t bytes);
+void pool_free(void* block, size_t bytes);
+// Bytes of blocks handed out, and of freed blocks kept for reuse
+size_t pool_liveBytes();
+size_t pool_cachedBytes();
+// Gives kept blocks back to the heap until at most keepBytes are left
+void pool_trim(size_t keepBytes);
+
+// Heap allocations made by arenas and the pool so far
+long arena_heapAllocs();
\ No newline at end of file
@@ -0,0 +1,440 @@
+#include "cdlod.h"
+
+#include "meshOpt.h"
+#include "jobs.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+// Same grid spacing as a lod 1 chunk
+static const float leafSize = 2.5f;
+// Distance covered by the finest level, doubling per level. Must stay well
+// above the node size so neighbours never differ by more than one level
+static const float leafRange = 6.f;
+// Fraction of a level's range after which its vertices start to morph
+static const float morphStart = 0.7f;
+// Frames a node may go unselected before its vertex data is dropped
+static const unsigned evictFrames = 600;
+
+#define NODE_GRID (CDLOD_NODE_CELLS + 1)
+#define NODE_VERTS (NODE_GRID * NODE_GRID)
+// Fine heights, morph heights, then normals
+#define NODE_VERTEX_BYTES (NODE_VERTS * (sizeof(uint16_t) * 2 + sizeof(uint32_t)))
+
+// Indices quadrant by quadrant, so a parent can draw only the quadrants
+// its children don't cover
+static bool createIndices(Cdlod* cdlod)
+{
+	unsigned half = CDLOD_NODE_CELLS / 2;
+	cdlod->quadrantIndices = (size_t)half * half * 6;
+
+	uint32_t* indices = malloc(sizeof(uint32_t) * cdlod->quadrantIndices * 4);
+	if (!indices)
+		return false;
+
+	Arena scratch = { 0 };
+	size_t pos = 0;
+	for (unsigned q = 0; q < 4; q++)
+	{
+		uint32_t* quadrant = indices + pos;
+		for (unsigned z = (q >> 1) * half; z < (q >> 1) * half + half; z++)
+			for (unsigned x = (q & 1) * half; x < (q & 1) * half + half; x++)
+			{
+				// Same winding and diagonal as gridIndices
+				uint32_t i00 = x + z * NODE_GRID;
+				uint32_t i10 = i00 + 1;
+				uint32_t i01 = i00 + NODE_GRID;
+				uint32_t i11 = i01 + 1;
+
+				indices[pos++] = i01;
+				indices[pos++] = i11;
+				indices[pos++] = i00;
+
+				indices[pos++] = i00;
+				indices[pos++] = i11;
+				indices[pos++] = i10;
+			}
+
+		arena_reset(&scratch);
+		optimizeVertexCache(quadrant, cdlod->quadrantIndices, NODE_VERTS, &scratch);
+	}
+
+	Mesh view = { 0 };
+	view.indices = indices;
+	view.indexCount = pos;
+	view.vertCount = NODE_VERTS;
+	view.primitive = GL_TRIANGLES;
+	view.triangles = pos / 3;
+	arena_reset(&scratch);
+	cdlod->acmr = computeACMR(&view, &scratch);
+	arena_free(&scratch);
+
+	glGenBuffers(1, &cdlod->ebo);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, cdlod->ebo);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(uint32_t) * pos, indices, GL_STATIC_DRAW);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	cdlod->gpuBytes += sizeof(uint32_t) * pos;
+
+	free(indices);
+	return true;
+}
+
+static void buildNode(size_t i, unsigned worker, void* data)
+{
+	Cdlod* cdlod = data;
+	CdlodNode* node = cdlod->missing[i];
+	Arena* scratch = &cdlod->scratch[worker];
+	arena_reset(scratch);
+
+	// One extra sample on every side for the normals
+	unsigned borderSize = NODE_GRID + 2;
+	float* border = arena_alloc(scratch, sizeof(float) * borderSize * borderSize);
+	float* heights = arena_alloc(scratch, sizeof(float) * NODE_VERTS);
+	if (!border || !heights)
+		return;
+
+	float spacing = node->size / CDLOD_NODE_CELLS;
+	for (unsigned z = 0; z < borderSize; z++)
+		noiseRow(border + z * borderSize, (node->x - spacing) / chunkScale, spacing / chunkScale,
+			(node->z + (z - 1.f) * spacing) / chunkScale, borderSize);
+
+	for (unsigned z = 0; z < NODE_GRID; z++)
+		memcpy(heights + z * NODE_GRID, border + (z + 1) * borderSize + 1, sizeof(float) * NODE_GRID);
+
+	uint8_t* vertices = cdlod->buildData + i * NODE_VERTEX_BYTES;
+	uint16_t* fine = (uint16_t*)vertices;
+	uint16_t* coarse = fine + NODE_VERTS;
+	uint32_t* normals = (uint32_t*)(coarse + NODE_VERTS);
+
+	node->maxHeight = noiseMod(quantizeHeights(fine, heights, NODE_VERTS));
+
+	// Odd vertices collapse onto the even vertex below them, which is where
+	// the shader moves them, so a fully morphed node is its parent's grid
+	for (unsigned z = 0; z < NODE_GRID; z++)
+		for (unsigned x = 0; x < NODE_GRID; x++)
+			coarse[x + z * NODE_GRID] = fine[(x & ~1u) + (z & ~1u) * NODE_GRID];
+
+	gridNormals(normals, border, NODE_GRID, spacing);
+
+	node->ready = true;
+}
+
+static void uploadNode(Cdlod* cdlod, CdlodNode* node, const uint8_t* vertices)
+{
+	glGenVertexArrays(1, &node->vao);
+	glBindVertexArray(node->vao);
+
+	glGenBuffers(1, &node->vbo);
+	glBindBuffer(GL_ARRAY_BUFFER, node->vbo);
+	glBufferData(GL_ARRAY_BUFFER, NODE_VERTEX_BYTES, vertices, GL_STATIC_DRAW);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, cdlod->ebo);
+
+	size_t morphOffset = NODE_VERTS * sizeof(uint16_t);
+	size_t normalOffset = NODE_VERTS * sizeof(uint16_t) * 2;
+	glVertexAttribPointer(0, 1, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(uint16_t), (void*)0);
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(1, 2, GL_SHORT, GL_TRUE, sizeof(uint32_t), (void*)normalOffset);
+	glEnableVertexAttribArray(1);
+	glVertexAttribPointer(2, 1, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(uint16_t), (void*)morphOffset);
+	glEnableVertexAttribArray(2);
+
+	glBindVertexArray(0);
+	cdlod->nodeCount++;
+	cdlod->gpuBytes += NODE_VERTEX_BYTES;
+}
+
+// Builds the missing nodes on every core, then uploads them
+static void buildMissing(Cdlod* cdlod)
+{
+	cdlod->built = cdlod->missingCount;
+	if (!cdlod->missingCount)
+		return;
+
+	job_parallelFor(cdlod->missingCount, buildNode, cdlod);
+
+	for (size_t i = 0; i < cdlod->missingCount; i++)
+		if (cdlod->missing[i]->ready)
+			uploadNode(cdlod, cdlod->missing[i], cdlod->buildData + i * NODE_VERTEX_BYTES);
+	cdlod->missingCount = 0;
+}
+
+static void freeNode(Cdlod* cdlod, CdlodNode* node)
+{
+	for (int q = 0; q < 4; q++)
+		if (node->children[q])
+		{
+			freeNode(cdlod, node->children[q]);
+			pool_free(node->children[q], sizeof(CdlodNode));
+			node->children[q] = NULL;
+		}
+
+	if (node->ready)
+	{
+		glDeleteVertexArrays(1, &node->vao);
+		glDeleteBuffers(1, &node->vbo);
+		node->ready = false;
+		cdlod->nodeCount--;
+		cdlod->gpuBytes -= NODE_VERTEX_BYTES;
+	}
+}
+
+bool cdlod_create(Cdlod* cdlod, float extent, float viewDist)
+{
+	memset(cdlod, 0, sizeof(Cdlod));
+
+	// Ranges double per level until the coarsest one reaches viewDist
+	float range = leafRange;
+	while (cdlod->levels < CDLOD_MAX_LEVELS - 1 && range < viewDist)
+	{
+		cdlod->ranges[cdlod->levels++] = range;
+		range *= 2.f;
+	}
+	cdlod->ranges[cdlod->levels++] = viewDist;
+
+	float rootSize = leafSize * (float)(1 << (cdlod->levels - 1));
+	cdlod->rootsPerSide = (int)ceilf(extent * 2.f / rootSize);
+
+	size_t rootCount = (size_t)cdlod->rootsPerSide * cdlod->rootsPerSide;
+	cdlod->buildBudget = max(rootCount, 32);
+
+	cdlod->roots = calloc(rootCount, sizeof(CdlodNode));
+	cdlod->scratch = calloc(job_workerCount(), sizeof(Arena));
+	cdlod->buildData = malloc(NODE_VERTEX_BYTES * cdlod->buildBudget);
+	cdlod->missing = malloc(sizeof(CdlodNode*) * cdlod->buildBudget);
+	cdlod->hidden = malloc(sizeof(CdlodNode*) * cdlod->buildBudget);
+	if (!cdlod->roots || !cdlod->scratch || !cdlod->buildData || !cdlod->missing || !cdlod->hidden || !createIndices(cdlod))
+	{
+		cdlod_destroy(cdlod);
+		return false;
+	}
+
+	for (int z = 0; z < cdlod->rootsPerSide; z++)
+		for (int x = 0; x < cdlod->rootsPerSide; x++)
+		{
+			CdlodNode* root = &cdlod->roots[x + z * cdlod->rootsPerSide];
+			root->x = (x - cdlod->rootsPerSide * 0.5f) * rootSize;
+			root->z = (z - cdlod->rootsPerSide * 0.5f) * rootSize;
+			root->size = rootSize;
+			root->level = cdlod->levels - 1;
+			cdlod->missing[cdlod->missingCount++] = root;
+		}
+
+	// Roots are the fallback for everything else, they are always built
+	buildMissing(cdlod);
+
+	return true;
+}
+
+void cdlod_destroy(Cdlod* cdlod)
+{
+	if (cdlod->roots)
+		for (int i = 0; i < cdlod->rootsPerSide * cdlod->rootsPerSide; i++)
+			freeNode(cdlod, &cdlod->roots[i]);
+
+	if (cdlod->scratch)
+		for (unsigned i = 0; i < job_workerCount(); i++)
+			arena_free(&cdlod->scratch[i]);
+
+	glDeleteBuffers(1, &cdlod->ebo);
+
+	free(cdlod->roots);
+	free(cdlod->scratch);
+	free(cdlod->buildData);
+	free(cdlod->missing);
+	free(cdlod->hidden);
+	free(cdlod->draws);
+	memset(cdlod, 0, sizeof(Cdlod));
+}
+
+
+// Distance from the camera to the node rectangle in xz, which is what the
+// shader morphs by
+static float nodeDistance(const CdlodNode* node, Vec3f camPos)
+{
+	float dx = fmaxf(fmaxf(node->x - camPos.x, camPos.x - node->x - node->size), 0.f);
+	float dz = fmaxf(fmaxf(node->z - camPos.z, camPos.z - node->z - node->size), 0.f);
+	return sqrtf(dx * dx + dz * dz);
+}
+
+// Same horizontal view cone as the chunk culling, widened by the node's radius
+static bool nodeVisible(const CdlodNode* node, Vec3f camPos, float camYaw, float fov)
+{
+	float radius = node->size * 0.7072f;
+	float cX = node->x + node->size * 0.5f;
+	float cZ = node->z + node->size * 0.5f;
+
+	float dist = sqrtf(pow2f(cX - camPos.x) + pow2f(cZ - camPos.z));
+	if (dist <= radius)
+		return true;
+
+	float angleDiff = fmodf(camYaw -
+		toDeg(fastAtan2(camPos.x - cX, camPos.z - cZ)) +
+		180.f + 360.f, 360.f) - 180.f;
+	return fabsf(angleDiff) <= fov * 0.667f + toDeg(asinf(radius / dist));
+}
+
+static CdlodNode* childNode(CdlodNode* node, int quadrant)
+{
+	if (node->children[quadrant])
+		return node->children[quadrant];
+
+	CdlodNode* child = pool_alloc(sizeof(CdlodNode));
+	if (!child)
+		return NULL;
+
+	memset(child, 0, sizeof(CdlodNode));
+	child->size = node->size * 0.5f;
+	child->x = node->x + (quadrant & 1) * child->size;
+	child->z = node->z + (quadrant >> 1) * child->size;
+	child->level = node->level - 1;
+
+	node->children[quadrant] = child;
+	return child;
+}
+
+static void addDraw(Cdlod* cdlod, CdlodNode* node, unsigned quadrants)
+{
+	if (cdlod->drawCount == cdlod->drawCapacity)
+	{
+		size_t capacity = max(cdlod->drawCapacity * 2, 64);
+		CdlodDraw* draws = realloc(cdlod->draws, sizeof(CdlodDraw) * capacity);
+		if (!draws)
+			return;
+		cdlod->draws = draws;
+		cdlod->drawCapacity = capacity;
+	}
+
+	cdlod->draws[cdlod->drawCount].node = node;
+	cdlod->draws[cdlod->drawCount].quadrants = quadrants;
+	cdlod->drawCount++;
+}
+
+// Returns false if the node can't cover its area, because it is out of
+// range or not built yet, and the parent has to draw that quadrant itself
+static bool selectNode(Cdlod* cdlod, CdlodNode* node, Vec3f camPos, float camYaw, float fov)
+{
+	node->lastUsed = cdlod->frame;
+
+	float dist = nodeDistance(node, camPos);
+	if (dist > cdlod->ranges[node->level])
+		return false;
+
+	bool visible = nodeVisible(node, camPos, camYaw, fov);
+	if (!node->ready)
+	{
+		if (visible && cdlod->missingCount < cdlod->buildBudget)
+			cdlod->missing[cdlod->missingCount++] = node;
+		else if (!visible && cdlod->hiddenCount < cdlod->buildBudget)
+			cdlod->hidden[cdlod->hiddenCount++] = node;
+		return false;
+	}
+
+	if (!visible)
+		return true;
+
+	unsigned quadrants = 0xF;
+	if (node->level > 0 && dist <= cdlod->ranges[node->level - 1])
+	{
+		quadrants = 0;
+		for (int q = 0; q < 4; q++)
+		{
+			CdlodNode* child = childNode(node, q);
+			if (!child || !selectNode(cdlod, child, camPos, camYaw, fov))
+				quadrants |= 1u << q;
+		}
+	}
+
+	if (quadrants)
+		addDraw(cdlod, node, quadrants);
+	return true;
+}
+
+static void evictNodes(Cdlod* cdlod, CdlodNode* node)
+{
+	for (int q = 0; q < 4; q++)
+	{
+		CdlodNode* child = node->children[q];
+		if (!child)
+			continue;
+
+		if (cdlod->frame - child->lastUsed > evictFrames)
+		{
+			freeNode(cdlod, child);
+			pool_free(child, sizeof(CdlodNode));
+			node->children[q] = NULL;
+		}
+		else
+		{
+			evictNodes(cdlod, child);
+		}
+	}
+}
+
+void cdlod_update(Cdlod* cdlod, Vec3f camPos, float camYaw, float fov)
+{
+	cdlod->frame++;
+	cdlod->drawCount = 0;
+	cdlod->missingCount = 0;
+	cdlod->hiddenCount = 0;
+
+	for (int i = 0; i < cdlod->rootsPerSide * cdlod->rootsPerSide; i++)
+		selectNode(cdlod, &cdlod->roots[i], camPos, camYaw, fov);
+
+	// Out of view only once everything in view fits the budget, so turning
+	// around later finds them built
+	for (size_t i = 0; i < cdlod->hiddenCount && cdlod->missingCount < cdlod->buildBudget; i++)
+		cdlod->missing[cdlod->missingCount++] = cdlod->hidden[i];
+
+	// Parents are selected before their children, so building in selection
+	// order refines coarse to fine
+	buildMissing(cdlod);
+
+	for (int i = 0; i < cdlod->rootsPerSide * cdlod->rootsPerSide; i++)
+		evictNodes(cdlod, &cdlod->roots[i]);
+}
+
+void cdlod_draw(Cdlod* cdlod, GLuint shader, Vec3f camPos)
+{
+	glh_setUniformInt(shader, "gridSize", NODE_GRID);
+	glh_setUniformInt(shader, "soup", false);
+
+	cdlod->triangles = 0;
+	for (size_t i = 0; i < cdlod->drawCount; i++)
+	{
+		CdlodNode* node = cdlod->draws[i].node;
+		unsigned quadrants = cdlod->draws[i].quadrants;
+
+		// Entirely under opaque water
+		if (node->maxHeight < seaLevel && camPos.y >= seaLevel)
+			continue;
+
+		float end = cdlod->ranges[node->level];
+		float start = node->level > 0 ? cdlod->ranges[node->level - 1] : 0.f;
+		glh_setUniformFloat(shader, "morphStart", start + (end - start) * morphStart);
+		glh_setUniformFloat(shader, "morphEnd", end);
+		glh_setUniformVec3(shader, "modelOrigin", vec3f(node->x, 0.f, node->z));
+		glh_setUniformVec3(shader, "modelScale", vec3f(node->size, noiseMod(1.f), node->size));
+
+		glBindVertexArray(node->vao);
+		if (quadrants == 0xF)
+		{
+			glDrawElements(GL_TRIANGLES, (GLsizei)(cdlod->quadrantIndices * 4), GL_UNSIGNED_INT, (void*)0);
+			cdlod->triangles += cdlod->quadrantIndices * 4 / 3;
+		}
+		else
+		{
+			for (unsigned q = 0; q < 4; q++)
+				if (quadrants & (1u << q))
+				{
+					glDrawElements(GL_TRIANGLES, (GLsizei)cdlod->quadrantIndices, GL_UNSIGNED_INT,
+						(void*)(sizeof(uint32_t) * cdlod->quadrantIndices * q));
+					cdlod->triangles += cdlod->quadrantIndices / 3;
+				}
+		}
+	}
+	glBindVertexArray(0);
+
+	// Chunk models don't morph
+	glh_setUniformFloat(shader, "morphEnd", 0.f);
+}
\ No newline at end of file
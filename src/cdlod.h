@@ -0,0 +1,68 @@
+#pragma once
+#include "terrain.h"
+
+// Continuous distance-dependent LOD, after Strugar's CDLOD
+// Every node is the same CDLOD_NODE_CELLS grid, covering twice the area of
+// its children. Vertices morph onto the next coarser grid towards the end
+// of their level's range, so levels meet without cracks or pops
+#define CDLOD_NODE_CELLS 32
+#define CDLOD_MAX_LEVELS 12
+
+typedef struct CdlodNode
+{
+	float x, z; // min corner in render units
+	float size;
+	int level;  // 0 is the finest
+	GLuint vao, vbo;
+	bool ready;
+	float maxHeight;
+	unsigned lastUsed; // frame it was last selected
+	struct CdlodNode* children[4];
+} CdlodNode;
+
+typedef struct CdlodDraw
+{
+	CdlodNode* node;
+	unsigned quadrants; // bit per child area, 0xF is the whole node
+} CdlodDraw;
+
+typedef struct Cdlod
+{
+	CdlodNode* roots;
+	int rootsPerSide;
+	int levels;
+	float ranges[CDLOD_MAX_LEVELS]; // selection distance per level
+
+	GLuint ebo; // shared by every node, quadrant by quadrant
+	size_t quadrantIndices;
+	float acmr;
+
+	Arena* scratch; // one per parallelFor worker
+	uint8_t* buildData; // vertex data of one batch, buildBudget nodes
+	CdlodNode** missing;
+	size_t missingCount;
+	CdlodNode** hidden; // missing but out of view, built with what's left of the budget
+	size_t hiddenCount;
+	size_t buildBudget; // nodes built per frame
+
+	CdlodDraw* draws;
+	size_t drawCount;
+	size_t drawCapacity;
+
+	unsigned frame;
+	size_t nodeCount; // nodes with vertex data
+	size_t gpuBytes;
+	size_t built;     // nodes built by the last cdlod_update
+	size_t triangles; // drawn by the last cdlod_draw
+} Cdlod;
+
+// extent is the half width of the terrain around the origin, viewDist the
+// range of the coarsest level
+bool cdlod_create(Cdlod* cdlod, float extent, float viewDist);
+void cdlod_destroy(Cdlod* cdlod);
+
+// Selects the nodes to draw for this camera and builds a batch of missing
+// ones. Areas whose node isn't built yet fall back to the parent
+void cdlod_update(Cdlod* cdlod, Vec3f camPos, float camYaw, float fov);
+// Expects shader bound with its camera uniforms set
+void cdlod_draw(Cdlod* cdlod, GLuint shader, Vec3f camPos);
\ No newline at end of file
@@ -0,0 +1,414 @@
+#ifndef _WIN32
+// mmap under strict C
+#define _POSIX_C_SOURCE 200809L
+#endif
+#include "chunkCache.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+typedef struct CacheHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t recordSize; // in case another compiler pads CacheRecord differently
+	uint64_t generator;
+} CacheHeader;
+
+// Followed by blockSize bytes laid out like Mesh.block
+struct CacheRecord
+{
+	CacheKey key;
+	uint32_t vertCount;
+	uint32_t indexCount;
+	uint32_t primitive;
+	uint32_t triangles;
+	uint32_t gridSize;
+	Vec3f origin;
+	Vec3f scale;
+	float maxHeight;
+	float acmr;
+	float lodError[MESH_ERROR_LEVELS];
+	uint32_t blockSize;
+	uint32_t blockCheck; // hash of the block, checked on load so a damaged one never reaches the GPU
+	uint32_t check; // hash of everything above, so a torn append isn't read back
+};
+
+static const char cacheMagic[8] = "CHUNKS\0";
+
+// FNV-1a
+static uint64_t hashBytes(uint64_t hash, const void* data, size_t size)
+{
+	const uint8_t* bytes = data;
+	for (size_t i = 0; i < size; i++)
+		hash = (hash ^ bytes[i]) * 1099511628211ull;
+	return hash;
+}
+
+static uint64_t hashFloat(uint64_t hash, float value)
+{
+	return hashBytes(hash, &value, sizeof(value));
+}
+
+static uint32_t recordCheck(const CacheRecord* record)
+{
+	uint64_t hash = hashBytes(14695981039346656037ull, record, offsetof(CacheRecord, check));
+	return (uint32_t)(hash ^ (hash >> 32));
+}
+
+// FNV-1a a word at a time, a block is hashed on every load. Blocks are
+// whole words
+static uint32_t blockCheck(const void* block, size_t size)
+{
+	const uint32_t* words = block;
+	uint64_t hash = 14695981039346656037ull;
+	for (size_t i = 0; i < size / sizeof(uint32_t); i++)
+		hash = (hash ^ words[i]) * 1099511628211ull;
+	return (uint32_t)(hash ^ (hash >> 32));
+}
+
+// Noise far apart, the constants it's shaped by, and every mesh mode on a
+// small area, so a change anywhere in the generator gives another hash
+static uint64_t generatorHash()
+{
+	uint64_t hash = 14695981039346656037ull;
+	hash = hashFloat(hash, seaLevel);
+	hash = hashFloat(hash, seaFloorDetail);
+	hash = hashFloat(hash, chunkSize);
+	hash = hashFloat(hash, chunkScale);
+	hash = hashFloat(hash, noiseMod(1.f));
+	for (int lod = 1; lod <= 8; lod++)
+	{
+		unsigned cells = lodCells(lod);
+		hash = hashBytes(hash, &cells, sizeof(cells));
+	}
+
+	for (int i = 0; i < 64; i++)
+		hash = hashFloat(hash, noise(i * 15731.f - 500000.f, i * -7919.f + 250000.f));
+
+	Arena scratch = { 0 };
+	for (int mode = 0; mode < MESH_MODE_COUNT; mode++)
+	{
+		Mesh mesh;
+		if (!buildAreaMesh(&mesh, &scratch, 3.f, -7.f, 1.f, 8, (MeshMode)mode, 0.5f))
+			continue;
+		// Not the whole block, the padding after the heights is never written
+		hash = hashBytes(hash, mesh.heights, mesh.vertCount * sizeof(uint16_t));
+		hash = hashBytes(hash, mesh.normals, mesh.vertCount * sizeof(uint32_t));
+		hash = hashBytes(hash, mesh.indices, mesh.indexCount * sizeof(uint32_t));
+		hash = hashBytes(hash, mesh.lodError, sizeof(mesh.lodError));
+		hash = hashFloat(hash, mesh.maxHeight);
+		freeMesh(&mesh);
+	}
+	arena_free(&scratch);
+
+	return hash;
+}
+
+static CacheKey makeKey(int x, int z, int lod, MeshMode mode, float maxError)
+{
+	CacheKey key = { x, z, lod, mode, 0 };
+	if (mode == MESH_ADAPTIVE)
+		memcpy(&key.errorBits, &maxError, sizeof(maxError));
+	return key;
+}
+
+static bool sameKey(const CacheKey* a, const CacheKey* b)
+{
+	return a->x == b->x && a->z == b->z && a->lod == b->lod && a->mode == b->mode && a->errorBits == b->errorBits;
+}
+
+static size_t keyHash(const CacheKey* key)
+{
+	uint64_t hash = (uint32_t)key->x * 0x9E3779B97F4A7C15ull;
+	hash ^= (uint32_t)key->z * 0xC2B2AE3D27D4EB4Full;
+	hash ^= ((uint64_t)key->lod << 32 | (uint64_t)key->mode << 40) ^ key->errorBits;
+	hash ^= hash >> 29;
+	hash *= 0xBF58476D1CE4E5B9ull;
+	return (size_t)(hash ^ (hash >> 32));
+}
+
+static CacheSlot* findSlot(const CacheIndex* index, const CacheKey* key)
+{
+	if (!index->capacity)
+		return NULL;
+
+	size_t mask = index->capacity - 1;
+	for (size_t i = keyHash(key) & mask;; i = (i + 1) & mask)
+	{
+		CacheSlot* slot = &index->slots[i];
+		if (!slot->used || sameKey(&slot->key, key))
+			return slot;
+	}
+}
+
+// Later records of the same key win
+static bool insertSlot(CacheIndex* index, const CacheKey* key, const CacheRecord* record)
+{
+	// Kept at most half full, so a probe always ends on an empty slot
+	if ((index->count + 1) * 2 > index->capacity)
+	{
+		CacheIndex grown = { 0 };
+		grown.capacity = index->capacity ? index->capacity * 2 : 1024;
+		grown.slots = calloc(grown.capacity, sizeof(CacheSlot));
+		if (!grown.slots)
+			return false;
+
+		for (size_t i = 0; i < index->capacity; i++)
+			if (index->slots[i].used)
+			{
+				*findSlot(&grown, &index->slots[i].key) = index->slots[i];
+				grown.count++;
+			}
+		free(index->slots);
+		*index = grown;
+	}
+
+	CacheSlot* slot = findSlot(index, key);
+	if (!slot->used)
+		index->count++;
+	slot->key = *key;
+	slot->record = record;
+	slot->used = true;
+	return true;
+}
+
+static size_t heightBytes(size_t vertCount)
+{
+	return (vertCount * sizeof(uint16_t) + 3) & ~(size_t)3;
+}
+
+// available is the file's size past record. The block itself is only
+// checked by cache_load, hashing every one here would read the whole file
+// before the first frame
+static bool validRecord(const CacheRecord* record, size_t available)
+{
+	if (record->check != recordCheck(record) || record->key.mode < 0 || record->key.mode >= MESH_MODE_COUNT)
+		return false;
+	size_t expected = heightBytes(record->vertCount) + ((size_t)record->vertCount + record->indexCount) * sizeof(uint32_t);
+	return record->blockSize == expected && sizeof(CacheRecord) + record->blockSize <= available;
+}
+
+static bool mapFile(ChunkCache* cache, const char* path)
+{
+#ifdef _WIN32
+	HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER size;
+	HANDLE mapping = NULL;
+	if (GetFileSizeEx(file, &size) && size.QuadPart > 0)
+		mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	CloseHandle(file);
+	if (!mapping)
+		return false;
+
+	// The view keeps the mapping alive
+	cache->map = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	CloseHandle(mapping);
+	if (!cache->map)
+		return false;
+	cache->mapSize = (size_t)size.QuadPart;
+#else
+	int file = open(path, O_RDONLY);
+	if (file < 0)
+		return false;
+
+	struct stat info;
+	void* map = MAP_FAILED;
+	if (fstat(file, &info) == 0 && info.st_size > 0)
+		map = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+	close(file);
+	if (map == MAP_FAILED)
+		return false;
+
+	cache->map = map;
+	cache->mapSize = (size_t)info.st_size;
+#endif
+	return true;
+}
+
+static void unmapFile(ChunkCache* cache)
+{
+	if (!cache->map)
+		return;
+#ifdef _WIN32
+	UnmapViewOfFile(cache->map);
+#else
+	munmap((void*)cache->map, cache->mapSize);
+#endif
+	cache->map = NULL;
+	cache->mapSize = 0;
+}
+
+// Indexes every intact record and returns where the next one goes, 0 if
+// the file can't be used
+static size_t indexFile(ChunkCache* cache, uint64_t generator)
+{
+	const CacheHeader* header = (const CacheHeader*)cache->map;
+	if (cache->mapSize < sizeof(CacheHeader) || memcmp(header->magic, cacheMagic, sizeof(cacheMagic)) != 0 ||
+		header->version != CACHE_VERSION || header->recordSize != sizeof(CacheRecord) || header->generator != generator)
+		return 0;
+
+	size_t offset = sizeof(CacheHeader);
+	while (offset + sizeof(CacheRecord) <= cache->mapSize)
+	{
+		const CacheRecord* record = (const CacheRecord*)(cache->map + offset);
+		if (!validRecord(record, cache->mapSize - offset))
+			break;
+		if (!insertSlot(&cache->mapped, &record->key, record))
+			break;
+		offset += sizeof(CacheRecord) + record->blockSize;
+	}
+	return offset;
+}
+
+bool cache_open(ChunkCache* cache, const char* path)
+{
+	memset(cache, 0, sizeof(ChunkCache));
+	cache->lock = (Mutex)MUTEX_INIT;
+	cache->maxBytes = (size_t)1 << 30;
+
+	uint64_t generator = generatorHash();
+	size_t end = mapFile(cache, path) ? indexFile(cache, generator) : 0;
+
+	// Appends go after the last intact record, over whatever a crash left
+	if (end)
+	{
+		cache->file = fopen(path, "r+b");
+		if (cache->file && fseek(cache->file, (long)end, SEEK_SET) != 0)
+		{
+			fclose(cache->file);
+			cache->file = NULL;
+		}
+		cache->fileSize = end;
+	}
+	else
+	{
+		unmapFile(cache);
+		free(cache->mapped.slots);
+		memset(&cache->mapped, 0, sizeof(CacheIndex));
+
+		CacheHeader header = { { 0 }, CACHE_VERSION, sizeof(CacheRecord), generator };
+		memcpy(header.magic, cacheMagic, sizeof(cacheMagic));
+		cache->file = fopen(path, "w+b");
+		if (cache->file && fwrite(&header, sizeof(header), 1, cache->file) != 1)
+		{
+			fclose(cache->file);
+			cache->file = NULL;
+		}
+		cache->fileSize = sizeof(header);
+	}
+
+	if (!cache->file)
+	{
+		cache_close(cache);
+		return false;
+	}
+	return true;
+}
+
+void cache_close(ChunkCache* cache)
+{
+	if (cache->file)
+		fclose(cache->file);
+	unmapFile(cache);
+	free(cache->mapped.slots);
+	free(cache->written.slots);
+	memset(cache, 0, sizeof(ChunkCache));
+}
+
+bool cache_load(ChunkCache* cache, Mesh* mesh, int x, int z, int lod, MeshMode mode, float maxError)
+{
+	CacheKey key = makeKey(x, z, lod, mode, maxError);
+	CacheSlot* slot = findSlot(&cache->mapped, &key);
+	if (!slot || !slot->used || thr_atomicLoad(&slot->damaged))
+	{
+		thr_atomicAdd(&cache->misses, 1);
+		return false;
+	}
+
+	// A damaged block is rebuilt and stored again, the new record wins
+	// from the next run on
+	const CacheRecord* record = slot->record;
+	if (record->blockCheck != blockCheck(record + 1, record->blockSize))
+	{
+		thr_atomicStore(&slot->damaged, 1);
+		thr_atomicAdd(&cache->misses, 1);
+		return false;
+	}
+	thr_atomicAdd(&cache->hits, 1);
+
+	memset(mesh, 0, sizeof(Mesh));
+	mesh->block = (void*)(record + 1);
+	mesh->blockSize = record->blockSize;
+	mesh->mapped = true;
+	mesh->heights = mesh->block;
+	mesh->normals = (uint32_t*)((uint8_t*)mesh->block + heightBytes(record->vertCount));
+	mesh->vertCount = record->vertCount;
+	mesh->indices = record->indexCount ? mesh->normals + record->vertCount : NULL;
+	mesh->indexCount = record->indexCount;
+	mesh->primitive = record->primitive;
+	mesh->triangles = record->triangles;
+	mesh->gridSize = record->gridSize;
+	mesh->origin = record->origin;
+	mesh->scale = record->scale;
+	mesh->maxHeight = record->maxHeight;
+	mesh->acmr = record->acmr;
+	memcpy(mesh->lodError, record->lodError, sizeof(mesh->lodError));
+	return true;
+}
+
+void cache_store(ChunkCache* cache, const Mesh* mesh, int x, int z, int lod, MeshMode mode, float maxError)
+{
+	CacheKey key = makeKey(x, z, lod, mode, maxError);
+	CacheSlot* slot = findSlot(&cache->mapped, &key);
+	if (mesh->mapped || (slot && slot->used && !thr_atomicLoad(&slot->damaged)))
+		return;
+
+	CacheRecord record;
+	memset(&record, 0, sizeof(record));
+	record.key = key;
+	record.vertCount = (uint32_t)mesh->vertCount;
+	record.indexCount = (uint32_t)mesh->indexCount;
+	record.primitive = mesh->primitive;
+	record.triangles = (uint32_t)mesh->triangles;
+	record.gridSize = mesh->gridSize;
+	record.origin = mesh->origin;
+	record.scale = mesh->scale;
+	record.maxHeight = mesh->maxHeight;
+	record.acmr = mesh->acmr;
+	memcpy(record.lodError, mesh->lodError, sizeof(record.lodError));
+	record.blockSize = (uint32_t)mesh->blockSize;
+	record.blockCheck = blockCheck(mesh->block, mesh->blockSize);
+	record.check = recordCheck(&record);
+	size_t bytes = sizeof(record) + mesh->blockSize;
+
+	thr_mutexLock(&cache->lock);
+	slot = findSlot(&cache->written, &key);
+	bool full = cache->maxBytes && cache->fileSize + bytes > cache->maxBytes;
+	if (cache->file && !full && !(slot && slot->used) && insertSlot(&cache->written, &key, NULL))
+	{
+		if (fwrite(&record, sizeof(record), 1, cache->file) == 1 && fwrite(mesh->block, mesh->blockSize, 1, cache->file) == 1)
+		{
+			cache->fileSize += bytes;
+			cache->storedBytes += bytes;
+		}
+		else
+		{
+			// Likely out of disk, what made it is still read back next time
+			fclose(cache->file);
+			cache->file = NULL;
+		}
+	}
+	thr_mutexUnlock(&cache->lock);
+}
\ No newline at end of file
@@ -0,0 +1,68 @@
+#pragma once
+#include "terrain.h"
+#include "thread.h"
+
+// Chunk meshes kept on disk between runs
+// The file is a header followed by records, each a mesh's description and
+// its block. On open the whole file is memory-mapped and indexed, so a hit
+// costs no noise and no copy, the mesh points straight into the mapping and
+// is uploaded from there. Meshes built this run are appended and show up
+// from the next run on. The header holds a hash of the generator, taken
+// from noise samples and a few tiny meshes, and a file made by any other
+// generator is started over
+#define CACHE_VERSION 2
+
+typedef struct CacheKey
+{
+	int32_t x, z;
+	int32_t lod;
+	int32_t mode;
+	uint32_t errorBits; // maxError for MESH_ADAPTIVE, 0 otherwise
+} CacheKey;
+
+typedef struct CacheRecord CacheRecord;
+
+typedef struct CacheSlot
+{
+	CacheKey key;
+	const CacheRecord* record; // in the mapping, NULL for keys written this run
+	bool used;
+	volatile long damaged; // its block failed the check on load
+} CacheSlot;
+
+// Open addressing on the key hash
+typedef struct CacheIndex
+{
+	CacheSlot* slots;
+	size_t capacity; // a power of two
+	size_t count;
+} CacheIndex;
+
+typedef struct ChunkCache
+{
+	const uint8_t* map;
+	size_t mapSize;
+	CacheIndex mapped; // read-only once open, but for CacheSlot.damaged
+
+	// Appends, guarded by lock
+	Mutex lock;
+	FILE* file;
+	size_t fileSize;
+	size_t maxBytes; // the file stops growing past this, 0 is unlimited
+	CacheIndex written;
+
+	volatile long hits;
+	volatile long misses;
+	size_t storedBytes; // appended this run
+} ChunkCache;
+
+// Creates the file, or starts it over when it's from another generator or
+// version. false only if it can't be written at all
+bool cache_open(ChunkCache* cache, const char* path);
+// Every mesh loaded from the cache has to be freed before
+void cache_close(ChunkCache* cache);
+
+// Fills mesh from the mapping, it stays valid until cache_close. Safe from any thread
+bool cache_load(ChunkCache* cache, Mesh* mesh, int x, int z, int lod, MeshMode mode, float maxError);
+// Appends mesh unless it is already in the file. Safe from any thread
+void cache_store(ChunkCache* cache, const Mesh* mesh, int x, int z, int lod, MeshMode mode, float maxError);
\ No newline at end of file
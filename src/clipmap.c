@@ -0,0 +1,264 @@
+#include "clipmap.h"
+
+#include "meshOpt.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+// Same grid spacing as a lod 1 chunk
+static const float finestSpacing = 20.f / 256.f;
+
+#define LEVEL_GRID (CLIPMAP_CELLS + 1)
+// Texels kept around the grid, for normals at the edge
+#define LEVEL_BORDER ((CLIPMAP_TEXELS - CLIPMAP_CELLS) / 2)
+
+// Cells of a coarser level that its finer level always covers. The finer
+// level starts one or two cells in from a quarter, depending on snapping
+#define HOLE_MIN (CLIPMAP_CELLS / 4 + 1)
+#define HOLE_MAX (CLIPMAP_CELLS * 3 / 4)
+
+static size_t cellIndices(uint32_t* indices, size_t pos, unsigned x, unsigned z)
+{
+	// Same winding and diagonal as gridIndices
+	uint32_t i00 = x + z * LEVEL_GRID;
+	uint32_t i10 = i00 + 1;
+	uint32_t i01 = i00 + LEVEL_GRID;
+	uint32_t i11 = i01 + 1;
+
+	indices[pos++] = i01;
+	indices[pos++] = i11;
+	indices[pos++] = i00;
+
+	indices[pos++] = i00;
+	indices[pos++] = i11;
+	indices[pos++] = i10;
+	return pos;
+}
+
+static bool createIndices(Clipmap* clipmap)
+{
+	size_t cells = (size_t)CLIPMAP_CELLS * CLIPMAP_CELLS;
+	uint32_t* indices = malloc(sizeof(uint32_t) * cells * 6 * 2);
+	if (!indices)
+		return false;
+
+	size_t pos = 0;
+	for (unsigned z = 0; z < CLIPMAP_CELLS; z++)
+		for (unsigned x = 0; x < CLIPMAP_CELLS; x++)
+			pos = cellIndices(indices, pos, x, z);
+	clipmap->gridIndices = pos;
+
+	for (unsigned z = 0; z < CLIPMAP_CELLS; z++)
+		for (unsigned x = 0; x < CLIPMAP_CELLS; x++)
+			if (x < HOLE_MIN || x >= HOLE_MAX || z < HOLE_MIN || z >= HOLE_MAX)
+				pos = cellIndices(indices, pos, x, z);
+	clipmap->ringIndices = pos - clipmap->gridIndices;
+
+	Arena scratch = { 0 };
+	optimizeVertexCache(indices, clipmap->gridIndices, (size_t)LEVEL_GRID * LEVEL_GRID, &scratch);
+	arena_reset(&scratch);
+	optimizeVertexCache(indices + clipmap->gridIndices, clipmap->ringIndices, (size_t)LEVEL_GRID * LEVEL_GRID, &scratch);
+	arena_free(&scratch);
+
+	// Vertices only come from gl_VertexID, the vao just holds the indices
+	glGenVertexArrays(1, &clipmap->vao);
+	glBindVertexArray(clipmap->vao);
+	glGenBuffers(1, &clipmap->ebo);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, clipmap->ebo);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(uint32_t) * pos, indices, GL_STATIC_DRAW);
+	glBindVertexArray(0);
+	clipmap->gpuBytes += sizeof(uint32_t) * pos;
+
+	free(indices);
+	return true;
+}
+
+bool clipmap_create(Clipmap* clipmap, float viewDist)
+{
+	memset(clipmap, 0, sizeof(Clipmap));
+	clipmap->spacing = finestSpacing;
+
+	// Each level reaches half its width from the camera
+	float reach = CLIPMAP_CELLS * 0.5f * finestSpacing;
+	clipmap->levelCount = 1;
+	while (clipmap->levelCount < CLIPMAP_MAX_LEVELS && reach < viewDist)
+	{
+		clipmap->levelCount++;
+		reach *= 2.f;
+	}
+
+	clipmap->row = malloc(sizeof(float) * CLIPMAP_TEXELS);
+	clipmap->strip = malloc(sizeof(uint16_t) * CLIPMAP_TEXELS * CLIPMAP_TEXELS);
+	if (!clipmap->row || !clipmap->strip || !createIndices(clipmap))
+	{
+		clipmap_destroy(clipmap);
+		return false;
+	}
+
+	// Repeat does the toroidal wrap, linear filtering samples a coarser
+	// level between its vertices
+	glGenTextures(1, &clipmap->heights);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, clipmap->heights);
+	glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_R16, CLIPMAP_TEXELS, CLIPMAP_TEXELS, clipmap->levelCount,
+		0, GL_RED, GL_UNSIGNED_SHORT, NULL);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+	clipmap->gpuBytes += sizeof(uint16_t) * CLIPMAP_TEXELS * CLIPMAP_TEXELS * clipmap->levelCount;
+
+	return true;
+}
+
+void clipmap_destroy(Clipmap* clipmap)
+{
+	glDeleteTextures(1, &clipmap->heights);
+	glDeleteBuffers(1, &clipmap->ebo);
+	glDeleteVertexArrays(1, &clipmap->vao);
+
+	free(clipmap->row);
+	free(clipmap->strip);
+	memset(clipmap, 0, sizeof(Clipmap));
+}
+
+
+static void uploadRect(int level, int texX, int texZ, int w, int h, const uint16_t* texels)
+{
+	glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, texX, texZ, level, w, h, 1, GL_RED, GL_UNSIGNED_SHORT, texels);
+}
+
+// Fills the texels of grid coordinates [x, x + w) x [z, z + h), which may
+// wrap around the texture edge once per axis
+static void updateRegion(Clipmap* clipmap, int level, int x, int z, int w, int h)
+{
+	float spacing = clipmap->spacing * (float)(1 << level);
+	for (int row = 0; row < h; row++)
+	{
+		noiseRow(clipmap->row, x * spacing / chunkScale, spacing / chunkScale, (z + row) * spacing / chunkScale, (unsigned)w);
+		quantizeHeights(clipmap->strip + row * w, clipmap->row, (size_t)w);
+	}
+
+	int texX = x & (CLIPMAP_TEXELS - 1);
+	int texZ = z & (CLIPMAP_TEXELS - 1);
+	int w0 = min(w, CLIPMAP_TEXELS - texX);
+	int h0 = min(h, CLIPMAP_TEXELS - texZ);
+
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 2);
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, w);
+	uploadRect(level, texX, texZ, w0, h0, clipmap->strip);
+	if (w0 < w)
+		uploadRect(level, 0, texZ, w - w0, h0, clipmap->strip + w0);
+	if (h0 < h)
+		uploadRect(level, texX, 0, w0, h - h0, clipmap->strip + h0 * w);
+	if (w0 < w && h0 < h)
+		uploadRect(level, 0, 0, w - w0, h - h0, clipmap->strip + h0 * w + w0);
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+	clipmap->texelsUpdated += (size_t)w * h;
+}
+
+static void updateLevel(Clipmap* clipmap, int level, Vec3f camPos)
+{
+	ClipLevel* clip = &clipmap->levels[level];
+	float spacing = clipmap->spacing * (float)(1 << level);
+
+	// Even origins keep the level's outline on the next coarser grid
+	int originX = 2 * (int)floorf(camPos.x / (spacing * 2.f)) - CLIPMAP_CELLS / 2;
+	int originZ = 2 * (int)floorf(camPos.z / (spacing * 2.f)) - CLIPMAP_CELLS / 2;
+	if (clip->valid && originX == clip->originX && originZ == clip->originZ)
+		return;
+
+	int newX = originX - LEVEL_BORDER;
+	int newZ = originZ - LEVEL_BORDER;
+	int oldX = clip->originX - LEVEL_BORDER;
+	int oldZ = clip->originZ - LEVEL_BORDER;
+	int dx = newX - oldX;
+	int dz = newZ - oldZ;
+
+	if (!clip->valid || abs(dx) >= CLIPMAP_TEXELS || abs(dz) >= CLIPMAP_TEXELS)
+	{
+		updateRegion(clipmap, level, newX, newZ, CLIPMAP_TEXELS, CLIPMAP_TEXELS);
+	}
+	else
+	{
+		// Only the strips that scrolled in, they overwrite the ones that left
+		if (dx > 0)
+			updateRegion(clipmap, level, oldX + CLIPMAP_TEXELS, newZ, dx, CLIPMAP_TEXELS);
+		else if (dx < 0)
+			updateRegion(clipmap, level, newX, newZ, -dx, CLIPMAP_TEXELS);
+
+		if (dz > 0)
+			updateRegion(clipmap, level, newX, oldZ + CLIPMAP_TEXELS, CLIPMAP_TEXELS, dz);
+		else if (dz < 0)
+			updateRegion(clipmap, level, newX, newZ, CLIPMAP_TEXELS, -dz);
+	}
+
+	clip->originX = originX;
+	clip->originZ = originZ;
+	clip->valid = true;
+}
+
+void clipmap_update(Clipmap* clipmap, Vec3f camPos)
+{
+	clipmap->texelsUpdated = 0;
+
+	glBindTexture(GL_TEXTURE_2D_ARRAY, clipmap->heights);
+	for (int level = 0; level < clipmap->levelCount; level++)
+		updateLevel(clipmap, level, camPos);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+}
+
+void clipmap_draw(Clipmap* clipmap, GLuint shader)
+{
+	glActiveTexture(GL_TEXTURE1);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, clipmap->heights);
+	glActiveTexture(GL_TEXTURE0);
+
+	glh_setUniformInt(shader, "heights", 1);
+	glh_setUniformInt(shader, "levelCount", clipmap->levelCount);
+	glh_setUniformInt(shader, "gridSize", LEVEL_GRID);
+	glh_setUniformInt(shader, "texels", CLIPMAP_TEXELS);
+	glh_setUniformFloat(shader, "heightScale", noiseMod(1.f));
+
+	glBindVertexArray(clipmap->vao);
+	clipmap->triangles = 0;
+
+	// Finest first, so the coarser levels behind it fail the depth test
+	for (int level = 0; level < clipmap->levelCount; level++)
+	{
+		ClipLevel* clip = &clipmap->levels[level];
+		float spacing = clipmap->spacing * (float)(1 << level);
+
+		glh_setUniformInt(shader, "level", level);
+		glh_setUniformFloat(shader, "spacing", spacing);
+		glh_setUniformVec3(shader, "levelOrigin", vec3f((float)clip->originX, 0.f, (float)clip->originZ));
+
+		// The finer level's footprint, the ring's edge cells are clipped to it
+		if (level > 0)
+		{
+			ClipLevel* inner = &clipmap->levels[level - 1];
+			float innerSpacing = spacing * 0.5f;
+			glh_setUniformVec3(shader, "innerMin",
+				vec3f(inner->originX * innerSpacing, 0.f, inner->originZ * innerSpacing));
+			glh_setUniformVec3(shader, "innerMax",
+				vec3f((inner->originX + CLIPMAP_CELLS) * innerSpacing, 0.f, (inner->originZ + CLIPMAP_CELLS) * innerSpacing));
+
+			glDrawElements(GL_TRIANGLES, (GLsizei)clipmap->ringIndices, GL_UNSIGNED_INT,
+				(void*)(sizeof(uint32_t) * clipmap->gridIndices));
+			clipmap->triangles += clipmap->ringIndices / 3;
+		}
+		else
+		{
+			glh_setUniformVec3(shader, "innerMin", vec3f(0.f, 0.f, 0.f));
+			glh_setUniformVec3(shader, "innerMax", vec3f(0.f, 0.f, 0.f));
+
+			glDrawElements(GL_TRIANGLES, (GLsizei)clipmap->gridIndices, GL_UNSIGNED_INT, (void*)0);
+			clipmap->triangles += clipmap->gridIndices / 3;
+		}
+	}
+
+	glBindVertexArray(0);
+}
\ No newline at end of file
@@ -0,0 +1,17 @@
+#version 330 core
+
+in vec4 outColor;
+in vec2 worldPos;
+out vec4 pixelColor;
+
+// Footprint of the next finer level, empty for the finest
+uniform vec3 innerMin;
+uniform vec3 innerMax;
+
+void main()
+{
+	if (all(greaterThan(worldPos, innerMin.xz)) && all(lessThan(worldPos, innerMax.xz)))
+		discard;
+
+	pixelColor = outColor;
+}
\ No newline at end of file
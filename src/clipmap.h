@@ -0,0 +1,46 @@
+#pragma once
+#include "terrain.h"
+
+// Geometry clipmaps, after Losasso and Hoppe
+// Nested square grids centred on the camera, each level with twice the
+// spacing of the one inside it. Heights live in one toroidally addressed
+// texture layer per level, so moving only regenerates the rows and columns
+// that scrolled into view, and memory doesn't depend on viewDist
+#define CLIPMAP_CELLS 124  // grid cells per level side, a multiple of 4
+#define CLIPMAP_TEXELS 128 // texels per level side, a power of two for the wrap
+#define CLIPMAP_MAX_LEVELS 12
+
+typedef struct ClipLevel
+{
+	int originX, originZ; // grid coordinates of the level's first vertex
+	bool valid;
+} ClipLevel;
+
+typedef struct Clipmap
+{
+	ClipLevel levels[CLIPMAP_MAX_LEVELS];
+	int levelCount;
+	float spacing; // of the finest level, in render units
+
+	GLuint heights; // 2D array, one R16 layer per level
+	GLuint vao;
+	GLuint ebo; // whole grid for level 0, then the ring for the others
+	size_t gridIndices;
+	size_t ringIndices;
+
+	float* row;      // one row of noise
+	uint16_t* strip; // quantized heights of one update region
+
+	size_t texelsUpdated; // by the last clipmap_update
+	size_t triangles;     // by the last clipmap_draw
+	size_t gpuBytes;
+} Clipmap;
+
+// Enough levels that the coarsest one reaches viewDist
+bool clipmap_create(Clipmap* clipmap, float viewDist);
+void clipmap_destroy(Clipmap* clipmap);
+
+// Recentres every level on the camera and fills the newly exposed texels
+void clipmap_update(Clipmap* clipmap, Vec3f camPos);
+// Expects the clipmap shader bound with its camera uniforms set
+void clipmap_draw(Clipmap* clipmap, GLuint shader);
\ No newline at end of file
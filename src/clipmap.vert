@@ -0,0 +1,100 @@
+#version 330 core
+
+out vec4 outColor;
+out vec2 worldPos;
+
+uniform mat4 projMat;
+uniform mat4 viewMat;
+uniform vec3 camPos;
+uniform float viewDist;
+uniform float seaLevel;
+
+// One layer per level, addressed by grid coordinate modulo texels
+uniform sampler2DArray heights;
+uniform int level;
+uniform int levelCount;
+uniform int gridSize;
+uniform int texels;
+uniform vec3 levelOrigin;
+uniform float spacing;
+uniform float heightScale;
+
+uniform vec3 lightDir;
+uniform float ambient;
+
+uniform sampler1D gradient;
+uniform float gradientMin;
+uniform float gradientMax;
+
+// Cells over which a level blends into the next coarser one
+const float transitionWidth = 12.0;
+
+float levelHeight(ivec2 grid)
+{
+	return texelFetch(heights, ivec3(grid & (texels - 1), level), 0).r;
+}
+
+// Bilinear, which is exact along the coarser level's triangle edges
+float coarseHeight(vec2 pos)
+{
+	vec2 grid = pos / (spacing * 2.0);
+	return texture(heights, vec3((grid + 0.5) / float(texels), float(level + 1))).r;
+}
+
+void main()
+{
+	ivec2 local = ivec2(gl_VertexID % gridSize, gl_VertexID / gridSize);
+	ivec2 grid = local + ivec2(levelOrigin.xz);
+	vec2 xz = vec2(grid) * spacing;
+
+	float height = levelHeight(grid);
+	vec3 normal = vec3(
+		(levelHeight(grid - ivec2(1, 0)) - levelHeight(grid + ivec2(1, 0))) * heightScale,
+		spacing * 2.0,
+		(levelHeight(grid - ivec2(0, 1)) - levelHeight(grid + ivec2(0, 1))) * heightScale);
+
+	// Towards the outer edge the level turns into the coarser one, so its
+	// border vertices lie on the coarser level's triangles
+	if (level + 1 < levelCount)
+	{
+		float edge = float(min(min(local.x, local.y), min(gridSize - 1 - local.x, gridSize - 1 - local.y)));
+		float blend = clamp(1.0 - edge / transitionWidth, 0.0, 1.0);
+		if (blend > 0.0)
+		{
+			float coarseSpacing = spacing * 2.0;
+			vec3 coarseNormal = vec3(
+				(coarseHeight(xz - vec2(coarseSpacing, 0.0)) - coarseHeight(xz + vec2(coarseSpacing, 0.0))) * heightScale,
+				coarseSpacing * 2.0,
+				(coarseHeight(xz - vec2(0.0, coarseSpacing)) - coarseHeight(xz + vec2(0.0, coarseSpacing))) * heightScale);
+
+			height = mix(height, coarseHeight(xz), blend);
+			normal = mix(normalize(normal), normalize(coarseNormal), blend);
+		}
+	}
+
+	vec3 pos = vec3(xz.x, height * heightScale, xz.y);
+	worldPos = xz;
+
+	gl_Position = projMat * viewMat * vec4(pos - camPos, 1.0);
+
+	float camDist = length(pos.xz - camPos.xz);
+
+	float diffuse = max(dot(normalize(normal), normalize(lightDir)), 0.0);
+	vec3 terrainColor = texture(gradient, (height - gradientMin) / (gradientMax - gradientMin)).rgb;
+	terrainColor *= ambient + (1.0 - ambient) * diffuse;
+	vec3 color = terrainColor;
+
+	if (camPos.y < seaLevel)
+	{
+		float depthEffect = clamp((1.0 - (camPos.y / seaLevel)) * 0.8 + 0.2, 0.0, 1.0);
+		vec3 waterColor = vec3(0.0, 0.0, 0.4);
+		color = mix(waterColor, terrainColor, depthEffect);
+	}
+
+	float a = 1.0;
+	float viewDistMod = viewDist - 100.0;
+	if (camDist > viewDistMod)
+		a = 1.0 - clamp((camDist - viewDistMod) * 0.01, 0.0, 1.0);
+
+	outColor = vec4(color, a);
+}
\ No newline at end of file
@@ -11,23 +11,61 @@ void glh_setView(unsigned width, unsigned height)
 }
 
 
-Model glh_loadModel(Vertex* verts, size_t count)
+Model glh_uploadModel(Mesh* mesh)
 {
 	Model model = { 0 };
-	model.count = count;
+	model.count = mesh->indices ? mesh->indexCount : mesh->vertCount;
+	model.primitive = mesh->primitive;
+	model.triangles = mesh->triangles;
+	model.gpuBytes = mesh->vertCount * (sizeof(uint16_t) + sizeof(uint32_t)) + mesh->indexCount * sizeof(uint32_t);
+	model.gridSize = mesh->gridSize;
+	model.origin = mesh->origin;
+	model.scale = mesh->scale;
+	model.maxHeight = mesh->maxHeight;
+	model.acmr = mesh->acmr;
+	// Heights first, then the normals, 4 byte aligned
+	model.normalOffset = (mesh->vertCount * sizeof(uint16_t) + 3) & ~(size_t)3;
+
+	// The copy target isn't vertex array state, so this works without a vao
+	glGenBuffers(1, &model.vbo);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, model.vbo);
+	size_t normalBytes = mesh->vertCount * sizeof(uint32_t);
+	glBufferData(GL_COPY_WRITE_BUFFER, model.normalOffset + normalBytes, NULL, GL_STATIC_DRAW);
+	glBufferSubData(GL_COPY_WRITE_BUFFER, 0, mesh->vertCount * sizeof(uint16_t), mesh->heights);
+	glBufferSubData(GL_COPY_WRITE_BUFFER, model.normalOffset, normalBytes, mesh->normals);
 
-	glGenVertexArrays(1, &model.vao);
-	glBindVertexArray(model.vao);
+	if (mesh->indices)
+	{
+		glGenBuffers(1, &model.ebo);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, model.ebo);
+		glBufferData(GL_COPY_WRITE_BUFFER, mesh->indexCount * sizeof(uint32_t), mesh->indices, GL_STATIC_DRAW);
+	}
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
 
-	glGenBuffers(1, &model.vbo);
-	glBindBuffer(GL_ARRAY_BUFFER, model.vbo);
-	glBufferData(GL_ARRAY_BUFFER, count * sizeof(Vertex), verts, GL_STATIC_DRAW);
+	return model;
+}
+
+void glh_bindModel(Model* model)
+{
+	glGenVertexArrays(1, &model->vao);
+	glBindVertexArray(model->vao);
 
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
+	glBindBuffer(GL_ARRAY_BUFFER, model->vbo);
+	if (model->ebo)
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, model->ebo);
+
+	glVertexAttribPointer(0, 1, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(uint16_t), (void*)0);
 	glEnableVertexAttribArray(0);
-	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)sizeof(Vec3f));
+	glVertexAttribPointer(1, 2, GL_SHORT, GL_TRUE, sizeof(uint32_t), (void*)model->normalOffset);
 	glEnableVertexAttribArray(1);
 
+	glBindVertexArray(0);
+}
+
+Model glh_loadModel(Mesh* mesh)
+{
+	Model model = glh_uploadModel(mesh);
+	glh_bindModel(&model);
 	return model;
 }
 
@@ -35,12 +73,34 @@ void glh_deleteModel(Model model)
 {
 	glDeleteVertexArrays(1, &model.vao);
 	glDeleteBuffers(1, &model.vbo);
+	glDeleteBuffers(1, &model.ebo);
 }
 
-void gls_drawModel(Model model)
+void gls_drawModel(GLuint shader, Model model)
 {
+	glh_setUniformVec3(shader, "modelOrigin", model.origin);
+	glh_setUniformVec3(shader, "modelScale", model.scale);
+	glh_setUniformInt(shader, "gridSize", (int)model.gridSize);
+	glh_setUniformInt(shader, "soup", model.ebo == 0);
 	glBindVertexArray(model.vao);
-	glDrawArrays(GL_TRIANGLES, 0, (GLsizei)model.count);
+	if (model.ebo)
+		glDrawElements(model.primitive, (GLsizei)model.count, GL_UNSIGNED_INT, (void*)0);
+	else
+		glDrawArrays(model.primitive, 0, (GLsizei)model.count);
+}
+
+GLuint glh_loadGradient(RGB* colors, size_t count)
+{
+	GLuint texture = 0;
+	glGenTextures(1, &texture);
+	glBindTexture(GL_TEXTURE_1D, texture);
+
+	glTexImage1D(GL_TEXTURE_1D, 0, GL_RGB8, (GLsizei)count, 0, GL_RGB, GL_FLOAT, colors);
+	glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+
+	return texture;
 }
 
 
@@ -138,6 +198,11 @@ void glh_setUniformVec3(GLuint shader, const char* name, Vec3f value)
 	glUniform3f(glGetUniformLocation(shader, name), value.x, value.y, value.z);
 }
 
+void glh_setUniformInt(GLuint shader, const char* name, int value)
+{
+	glUniform1i(glGetUniformLocation(shader, name), value);
+}
+
 void glh_setUniformFloat(GLuint shader, const char* name, float value)
 {
 	glUniform1f(glGetUniformLocation(shader, name), value);
@@ -149,29 +214,17 @@ void glh_setUniformMat4(GLuint shader, const char* name, Matrix4* value)
 }
 
 
-void glh_updateCamera(GLuint shader, Object* camera, float fov, float viewDist)
+void glh_setCamera(GLuint shader, Vec3f eye, Vec3f lookat, Vec3f up, float fov, float aspect, float near, float far, float viewDist)
 {
 	Matrix4 projMat = { 0 };
 	Matrix4 viewMat = { 0 };
 
-	float aspect = (float)glh_width / (float)glh_height;
-
-	float far = 10000.f;
-	float near = 0.01f;
-
 	projMat.m[0 + 0 * 4] = 1.f / (aspect * tanf(toRad(fov) / 2.f));
 	projMat.m[1 + 1 * 4] = 1.f / tanf(toRad(fov) / 2.f);
 	projMat.m[2 + 2 * 4] = (far + near) / (near - far);
 	projMat.m[3 + 2 * 4] = -1.f;
 	projMat.m[2 + 3 * 4] = -(2.f * far * near) / (far - near);
 
-	Vec3f up = { 0.f, 1.f, 0.f };
-	Vec3f lookat = normalize(vec3f(
-		-sinf(toRad(camera->trans.rot.y)) * cosf(toRad(camera->trans.rot.x)),
-		 sinf(toRad(camera->trans.rot.x)),
-		-cosf(toRad(camera->trans.rot.y)) * cosf(toRad(camera->trans.rot.x))));
-	Vec3f eye = camera->trans.pos;
-	eye.y += 0.5f;
 	Vec3f s = normalize(cross(lookat, up));
 	Vec3f u = cross(s, lookat);
 
@@ -191,3 +244,16 @@ void glh_updateCamera(GLuint shader, Object* camera, float fov, float viewDist)
 	glh_setUniformVec3(shader, "camPos", eye);
 	glh_setUniformFloat(shader, "viewDist", viewDist);
 }
+
+void glh_updateCamera(GLuint shader, Object* camera, float fov, float viewDist)
+{
+	Vec3f lookat = normalize(vec3f(
+		-sinf(toRad(camera->trans.rot.y)) * cosf(toRad(camera->trans.rot.x)),
+		 sinf(toRad(camera->trans.rot.x)),
+		-cosf(toRad(camera->trans.rot.y)) * cosf(toRad(camera->trans.rot.x))));
+	Vec3f eye = camera->trans.pos;
+	eye.y += 0.5f;
+
+	glh_setCamera(shader, eye, lookat, vec3f(0.f, 1.f, 0.f),
+		fov, (float)glh_width / (float)glh_height, 0.01f, 10000.f, viewDist);
+}
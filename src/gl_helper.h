@@ -1,6 +1,7 @@
 #pragma once
 #include <glad/glad.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <string.h>
 #include <stdio.h>
 #include <math.h>
@@ -15,11 +16,38 @@ extern unsigned glh_height;
 void glh_setView(unsigned width, unsigned height);
 
 
-typedef struct Vertex
+// Ends a triangle strip inside one draw call
+#define RESTART_INDEX 0xFFFFFFFFu
+
+// Grid sizes a mesh records its geometric error for, 1 to 256 cells
+#define MESH_ERROR_LEVELS 9
+
+// CPU side terrain grid, ready to upload
+// Each vertex is only a unorm16 height, x and z are rebuilt in the vertex
+// shader from gl_VertexID on a gridSize * gridSize grid spanning origin/scale.
+// Without indices the heights are a soup of six samples per grid cell.
+// Colour comes from the gradient texture sampled by height
+typedef struct Mesh
 {
-	Vec3f pos;
-	RGB rgb;
-} Vertex;
+	void* block; // heights, normals and indices live in one allocation
+	size_t blockSize;
+	bool mapped; // block is part of a mapped cache file instead of the pool
+	uint16_t* heights;
+	uint32_t* normals; // octEncode, one per vertex
+	size_t vertCount;
+	uint32_t* indices;
+	size_t indexCount;
+	GLenum primitive;
+	size_t triangles;
+	unsigned gridSize;
+	Vec3f origin;
+	Vec3f scale;
+	float maxHeight;
+	float acmr; // average cache miss ratio of the index order
+	// Largest height error in render units if the same area used a 2^i
+	// cell grid instead, measured for coarser grids and estimated otherwise
+	float lodError[MESH_ERROR_LEVELS];
+} Mesh;
 
 typedef struct Transform
 {
@@ -38,16 +66,32 @@ typedef struct Object
 typedef struct Model
 {
 	size_t count;
-	GLuint vao, vbo;
+	GLuint vao, vbo, ebo;
+	size_t normalOffset; // in vbo, after the heights
+	GLenum primitive;
+	size_t triangles;
+	size_t gpuBytes;
+	unsigned gridSize;
+	Vec3f origin;
+	Vec3f scale;
+	float maxHeight;
+	float acmr;
 } Model;
 
 extern size_t triCount;
 
-Model glh_loadModel(Vertex* verts, size_t count);
+Model glh_loadModel(Mesh* mesh);
+// The two halves of glh_loadModel. Buffers are shared between contexts
+// and vertex arrays aren't, so a loader context can fill the buffers and
+// leave the vao to the context that draws
+Model glh_uploadModel(Mesh* mesh);
+void glh_bindModel(Model* model);
 
 void glh_deleteModel(Model model);
 
-void gls_drawModel(Model model);
+void gls_drawModel(GLuint shader, Model model);
+
+GLuint glh_loadGradient(RGB* colors, size_t count);
 
 
 char* readFile(const char* filename);
@@ -62,7 +106,10 @@ typedef struct Matrix4
 
 
 void glh_setUniformVec3(GLuint shader, const char* name, Vec3f value);
+void glh_setUniformInt(GLuint shader, const char* name, int value);
 void glh_setUniformFloat(GLuint shader, const char* name, float value);
 void glh_setUniformMat4(GLuint shader, const char* name, Matrix4* value);
 
+// Camera uniforms for a view from eye along lookat, fov is vertical
+void glh_setCamera(GLuint shader, Vec3f eye, Vec3f lookat, Vec3f up, float fov, float aspect, float near, float far, float viewDist);
 void glh_updateCamera(GLuint shader, Object* camera, float fov, float viewDist);
\ No newline at end of file
@@ -0,0 +1,215 @@
+#include "horizon.h"
+#include "jobs.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+// Rarely rebuilt, so it can afford a fine error
+static const float farMeshError = 0.25f;
+// Near plane of the capture, only has to keep the depth precision for
+// farDist, the panorama's start is cut by distance instead
+static const float captureNear = 1.f;
+
+// Directions and up vectors of the cubemap faces, in GL's face order
+static const Vec3f faceLookat[6] = {
+	{ 1.f, 0.f, 0.f }, { -1.f, 0.f, 0.f },
+	{ 0.f, 1.f, 0.f }, { 0.f, -1.f, 0.f },
+	{ 0.f, 0.f, 1.f }, { 0.f, 0.f, -1.f } };
+static const Vec3f faceUp[6] = {
+	{ 0.f, -1.f, 0.f }, { 0.f, -1.f, 0.f },
+	{ 0.f, 0.f, 1.f }, { 0.f, 0.f, -1.f },
+	{ 0.f, -1.f, 0.f }, { 0.f, -1.f, 0.f } };
+
+bool horizon_create(Horizon* horizon, float viewDist, float farDist)
+{
+	memset(horizon, 0, sizeof(Horizon));
+	horizon->farDist = farDist;
+	horizon_setViewDist(horizon, viewDist);
+
+	glGenTextures(1, &horizon->panorama);
+	glBindTexture(GL_TEXTURE_CUBE_MAP, horizon->panorama);
+	for (int face = 0; face < 6; face++)
+		glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, 0, GL_RGB8, HORIZON_FACE_SIZE, HORIZON_FACE_SIZE,
+			0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+	glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+
+	glGenRenderbuffers(1, &horizon->depth);
+	glBindRenderbuffer(GL_RENDERBUFFER, horizon->depth);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, HORIZON_FACE_SIZE, HORIZON_FACE_SIZE);
+	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+	glGenFramebuffers(1, &horizon->fbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, horizon->fbo);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, horizon->depth);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_CUBE_MAP_POSITIVE_X, horizon->panorama, 0);
+	bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	glGenVertexArrays(1, &horizon->vao);
+
+	if (!complete)
+	{
+		horizon_destroy(horizon);
+		return false;
+	}
+	return true;
+}
+
+void horizon_destroy(Horizon* horizon)
+{
+	while (thr_atomicLoad(&horizon->building))
+		thr_yield();
+	if (horizon->hasNext)
+		freeMesh(&horizon->next);
+
+	glh_deleteModel(horizon->model);
+	arena_free(&horizon->scratch);
+
+	glDeleteFramebuffers(1, &horizon->fbo);
+	glDeleteRenderbuffers(1, &horizon->depth);
+	glDeleteTextures(1, &horizon->panorama);
+	glDeleteVertexArrays(1, &horizon->vao);
+	memset(horizon, 0, sizeof(Horizon));
+}
+
+void horizon_setViewDist(Horizon* horizon, float viewDist)
+{
+	horizon->nearDist = fmaxf(viewDist - 100.f, 1.f);
+	// Parallax of the nearest panorama terrain stays around a degree
+	horizon->recaptureDist = horizon->nearDist * 0.02f;
+	horizon->captured = false;
+}
+
+bool horizon_stale(Horizon* horizon, Vec3f camPos)
+{
+	if (!horizon->captured)
+		return true;
+	if (!thr_atomicLoad(&horizon->building) && horizon->hasNext)
+		return true;
+
+	Vec3f d = vec3f(camPos.x - horizon->capturePos.x, camPos.y - horizon->capturePos.y, camPos.z - horizon->capturePos.z);
+	return d.x * d.x + d.y * d.y + d.z * d.z > horizon->recaptureDist * horizon->recaptureDist;
+}
+
+typedef struct MeshJob
+{
+	Horizon* horizon;
+	Vec3f center;
+} MeshJob;
+
+// The mesh reaches a quarter of farDist past its centre
+static float meshSlack(const Horizon* horizon)
+{
+	return horizon->farDist * 0.25f;
+}
+
+static void meshJob(Job* job, unsigned worker)
+{
+	MeshJob data;
+	memcpy(&data, job->data, sizeof(data));
+	Horizon* horizon = data.horizon;
+
+	horizon->hasNext = buildAreaMesh(&horizon->next, &horizon->scratch, data.center.x, data.center.z,
+		horizon->farDist + meshSlack(horizon), HORIZON_CELLS, MESH_ADAPTIVE, farMeshError);
+	horizon->nextCenter = data.center;
+	thr_atomicStore(&horizon->building, 0);
+}
+
+// Swaps in a finished mesh, and starts the next one once the camera moved
+// past the slack. Until the first one is done only the water is captured
+static void updateMesh(Horizon* horizon, Vec3f camPos)
+{
+	if (thr_atomicLoad(&horizon->building))
+		return;
+
+	if (horizon->hasNext)
+	{
+		glh_deleteModel(horizon->model);
+		horizon->model = glh_loadModel(&horizon->next);
+		freeMesh(&horizon->next);
+		horizon->hasNext = false;
+		horizon->meshCenter = horizon->nextCenter;
+		horizon->meshValid = true;
+	}
+
+	float slack = meshSlack(horizon);
+	if (horizon->meshValid &&
+		fabsf(camPos.x - horizon->meshCenter.x) <= slack &&
+		fabsf(camPos.z - horizon->meshCenter.z) <= slack)
+		return;
+
+	MeshJob data = { horizon, camPos };
+	thr_atomicStore(&horizon->building, 1);
+	job_runBackground(job_create(NULL, meshJob, &data, sizeof(data)));
+}
+
+void horizon_capture(Horizon* horizon, Vec3f camPos, GLuint shader, GLuint waterShader)
+{
+	updateMesh(horizon, camPos);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, horizon->fbo);
+	glViewport(0, 0, HORIZON_FACE_SIZE, HORIZON_FACE_SIZE);
+
+	for (int face = 0; face < 6; face++)
+	{
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_CUBE_MAP_POSITIVE_X + face,
+			horizon->panorama, 0);
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+		// What the near terrain draws itself is cut away by distance along
+		// the ground. A near plane at nearDist would also cut the near
+		// terrain's fade along the face diagonals, out to nearDist * sqrt(2)
+		glUseProgram(waterShader);
+		glh_setCamera(waterShader, camPos, faceLookat[face], faceUp[face], 90.f, 1.f,
+			captureNear, horizon->farDist * 2.f, horizon->farDist);
+		glh_setUniformFloat(waterShader, "seaLevel", seaLevel);
+		glh_setUniformFloat(waterShader, "clipDist", horizon->nearDist);
+		glDisable(GL_CULL_FACE);
+		glBindVertexArray(horizon->vao);
+		glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+		glEnable(GL_CULL_FACE);
+
+		glUseProgram(shader);
+		glh_setCamera(shader, camPos, faceLookat[face], faceUp[face], 90.f, 1.f,
+			captureNear, horizon->farDist * 2.f, horizon->farDist);
+		glh_setUniformFloat(shader, "clipDist", horizon->nearDist);
+		if (horizon->meshValid)
+			gls_drawModel(shader, horizon->model);
+	}
+
+	// Both shaders draw the near view next
+	glh_setUniformFloat(shader, "clipDist", 0.f);
+	glUseProgram(waterShader);
+	glh_setUniformFloat(waterShader, "clipDist", 0.f);
+
+	glBindVertexArray(0);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glViewport(0, 0, glh_width, glh_height);
+
+	horizon->capturePos = camPos;
+	horizon->captured = true;
+	horizon->captures++;
+}
+
+void horizon_draw(Horizon* horizon, GLuint shader)
+{
+	glActiveTexture(GL_TEXTURE2);
+	glBindTexture(GL_TEXTURE_CUBE_MAP, horizon->panorama);
+	glActiveTexture(GL_TEXTURE0);
+	glh_setUniformInt(shader, "panorama", 2);
+
+	// Behind everything, so it neither tests nor writes depth
+	glDisable(GL_DEPTH_TEST);
+	glDepthMask(GL_FALSE);
+	glBindVertexArray(horizon->vao);
+	glDrawArrays(GL_TRIANGLES, 0, 3);
+	glBindVertexArray(0);
+	glDepthMask(GL_TRUE);
+	glEnable(GL_DEPTH_TEST);
+}
\ No newline at end of file
@@ -0,0 +1,11 @@
+#version 330 core
+
+in vec3 viewRay;
+out vec4 pixelColor;
+
+uniform samplerCube panorama;
+
+void main()
+{
+	pixelColor = vec4(texture(panorama, viewRay).rgb, 1.0);
+}
\ No newline at end of file
@@ -0,0 +1,53 @@
+#pragma once
+#include "terrain.h"
+
+// Far field past viewDist, drawn as a panorama behind the near terrain
+// A coarse mesh of the surroundings is rendered into a cubemap from the
+// camera, and only again once the camera moved recaptureDist away. The
+// near terrain fades out into it instead of into the background
+#define HORIZON_FACE_SIZE 256
+#define HORIZON_CELLS 256
+
+typedef struct Horizon
+{
+	float nearDist; // where the near terrain starts fading, the panorama starts there
+	float farDist;
+	float recaptureDist;
+
+	Model model; // far terrain, covers farDist around any capture near meshCenter
+	Vec3f meshCenter;
+	bool meshValid;
+
+	// The next mesh is built by a background job and swapped in by the
+	// capture after it's done, the frame never waits for it
+	volatile long building; // 1 while the job runs, it owns the fields below
+	Mesh next;
+	Vec3f nextCenter;
+	bool hasNext;
+	Arena scratch;
+
+	GLuint panorama; // cubemap
+	GLuint depth;
+	GLuint fbo;
+	GLuint vao; // empty, the composite triangle comes from gl_VertexID
+	Vec3f capturePos;
+	bool captured;
+
+	size_t captures;
+} Horizon;
+
+bool horizon_create(Horizon* horizon, float viewDist, float farDist);
+void horizon_destroy(Horizon* horizon);
+// Moves the start of the panorama along with the near terrain's fade
+void horizon_setViewDist(Horizon* horizon, float viewDist);
+
+// The camera moved far enough from the last capture to redo it, or a new
+// far mesh is ready
+bool horizon_stale(Horizon* horizon, Vec3f camPos);
+// Renders the far terrain around camPos into the panorama, with shader's
+// gradient and lighting uniforms already set. Leaves the default
+// framebuffer bound with a glh_width * glh_height viewport
+void horizon_capture(Horizon* horizon, Vec3f camPos, GLuint shader, GLuint waterShader);
+// Fills the screen with the panorama, expects shader bound with its camera
+// uniforms set and is meant to go right after the clear
+void horizon_draw(Horizon* horizon, GLuint shader);
\ No newline at end of file
@@ -0,0 +1,20 @@
+#version 330 core
+
+out vec3 viewRay;
+
+uniform mat4 projMat;
+uniform mat4 viewMat;
+
+void main()
+{
+	// One triangle covering the screen, corners come from the vertex index
+	vec2 corner = vec2(
+		(gl_VertexID & 1) != 0 ? 3.0 : -1.0,
+		(gl_VertexID & 2) != 0 ? 3.0 : -1.0);
+
+	// The view matrix is a pure rotation, its transpose turns the ray back
+	vec4 view = inverse(projMat) * vec4(corner, 1.0, 1.0);
+	viewRay = transpose(mat3(viewMat)) * (view.xyz / view.w);
+
+	gl_Position = vec4(corner, 1.0, 1.0);
+}
\ No newline at end of file
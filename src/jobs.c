@@ -0,0 +1,407 @@
+#include "jobs.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Failed searches before a worker goes to sleep
+#define JOB_SPINS 64
+
+typedef struct Worker
+{
+	// Deque of job indices, the owner works at the bottom and thieves at
+	// the top. Kept apart so they don't share a cache line
+	volatile long top;
+	char pad0[64];
+	volatile long bottom;
+	char pad1[64];
+	long entries[JOB_POOL_SIZE];
+
+	Thread thread;
+	unsigned nextJob; // pool slot handed out next
+	unsigned seed;    // for picking whom to steal from
+	JobStats stats;
+	double idleSince; // 0 while busy, job_stats counts the idle time so far
+} Worker;
+
+static Worker* workers;
+static unsigned workerCount;
+static Job* jobs; // JOB_POOL_SIZE per worker, a job's index is its place here
+static Queue background; // job indices, see job_runBackground
+static volatile long running;
+static volatile long nextWorker;
+
+// Only for going to sleep and waking up, never touched while there's work
+static Mutex sleepLock = MUTEX_INIT;
+static Cond wake = COND_INIT;
+static volatile long sleepers;
+
+// -1 on threads that aren't workers
+static THR_LOCAL int currentWorker = -1;
+
+// Positions only ever grow, compared through their difference so they stay
+// right when they wrap
+static long posDiff(long a, long b)
+{
+	return (long)((unsigned long)a - (unsigned long)b);
+}
+
+static void push(Worker* worker, long job)
+{
+	long bottom = thr_atomicLoad(&worker->bottom);
+	thr_atomicStore(&worker->entries[bottom & (JOB_POOL_SIZE - 1)], job);
+	thr_atomicStore(&worker->bottom, bottom + 1);
+}
+
+static long pop(Worker* worker)
+{
+	long bottom = thr_atomicLoad(&worker->bottom) - 1;
+	thr_atomicStore(&worker->bottom, bottom);
+	long top = thr_atomicLoad(&worker->top);
+
+	if (posDiff(bottom, top) < 0)
+	{
+		thr_atomicStore(&worker->bottom, top);
+		return -1;
+	}
+
+	long job = thr_atomicLoad(&worker->entries[bottom & (JOB_POOL_SIZE - 1)]);
+	if (bottom != top)
+		return job;
+
+	// Last one, a thief may be taking it at the same time
+	if (!thr_atomicCas(&worker->top, top, top + 1))
+		job = -1;
+	thr_atomicStore(&worker->bottom, top + 1);
+	return job;
+}
+
+static long steal(Worker* worker)
+{
+	long top = thr_atomicLoad(&worker->top);
+	long bottom = thr_atomicLoad(&worker->bottom);
+	if (posDiff(bottom, top) <= 0)
+		return -1;
+
+	long job = thr_atomicLoad(&worker->entries[top & (JOB_POOL_SIZE - 1)]);
+	if (!thr_atomicCas(&worker->top, top, top + 1))
+		return -1;
+	return job;
+}
+
+static bool workAvailable()
+{
+	for (unsigned w = 0; w < workerCount; w++)
+		if (posDiff(thr_atomicLoad(&workers[w].bottom), thr_atomicLoad(&workers[w].top)) > 0)
+			return true;
+	return thr_queueCount(&background) > 0;
+}
+
+// Own jobs first, newest first, then the oldest of someone else's and
+// then background ones, which the main thread leaves alone
+static Job* findJob(unsigned w)
+{
+	Worker* worker = &workers[w];
+	long job = pop(worker);
+	if (job >= 0)
+		return &jobs[job];
+
+	worker->seed ^= worker->seed << 13;
+	worker->seed ^= worker->seed >> 17;
+	worker->seed ^= worker->seed << 5;
+	unsigned first = worker->seed % workerCount;
+	for (unsigned i = 0; i < workerCount; i++)
+	{
+		unsigned victim = (first + i) % workerCount;
+		if (victim == w)
+			continue;
+		job = steal(&workers[victim]);
+		if (job >= 0)
+		{
+			worker->stats.steals++;
+			return &jobs[job];
+		}
+	}
+
+	if (w != 0 && thr_queuePop(&background, &job))
+		return &jobs[job];
+	return NULL;
+}
+
+static void finish(Job* job)
+{
+	// The slot can be reused as soon as the count reaches zero
+	while (job)
+	{
+		Job* parent = job->parent;
+		if (thr_atomicAdd(&job->unfinished, -1) != 0)
+			break;
+		job = parent;
+	}
+}
+
+static void beginIdle(Worker* worker)
+{
+	if (worker->idleSince == 0.0)
+		worker->idleSince = thr_time();
+}
+
+static void endIdle(Worker* worker)
+{
+	if (worker->idleSince == 0.0)
+		return;
+	double idle = thr_time() - worker->idleSince;
+	worker->idleSince = 0.0;
+	worker->stats.idleSeconds += idle;
+}
+
+static void execute(Job* job, unsigned w)
+{
+	job->func(job, w);
+	finish(job);
+	workers[w].stats.jobs++;
+}
+
+// Job pushes are only followed by a lock when someone sleeps. A sleeper
+// counts itself before it looks at the deques one last time, so either it
+// sees the new job or the pusher sees it and wakes it
+static void sleepUntilWork()
+{
+	thr_mutexLock(&sleepLock);
+	thr_atomicAdd(&sleepers, 1);
+	if (thr_atomicLoad(&running) && !workAvailable())
+		thr_condWait(&wake, &sleepLock);
+	thr_atomicAdd(&sleepers, -1);
+	thr_mutexUnlock(&sleepLock);
+}
+
+static int workerThread(void* data)
+{
+	unsigned w = (unsigned)thr_atomicAdd(&nextWorker, 1);
+	currentWorker = (int)w;
+	Worker* worker = &workers[w];
+
+	unsigned spins = 0;
+	while (thr_atomicLoad(&running))
+	{
+		Job* job = findJob(w);
+		if (job)
+		{
+			endIdle(worker);
+			spins = 0;
+			execute(job, w);
+			continue;
+		}
+
+		beginIdle(worker);
+		if (++spins < JOB_SPINS)
+			thr_yield();
+		else
+			sleepUntilWork();
+	}
+	return 0;
+}
+
+bool job_start(unsigned count)
+{
+	if (count == 0)
+		count = thr_cpuCount();
+
+	workers = calloc(count, sizeof(Worker));
+	jobs = calloc((size_t)count * JOB_POOL_SIZE, sizeof(Job));
+	bool queued = thr_queueCreate(&background, JOB_POOL_SIZE, sizeof(long));
+	if (!workers || !jobs || !queued)
+	{
+		if (queued)
+			thr_queueDestroy(&background);
+		free(workers);
+		free(jobs);
+		workers = NULL;
+		jobs = NULL;
+		return false;
+	}
+
+	for (unsigned w = 0; w < count; w++)
+		workers[w].seed = 2463534242u + w * 7919u;
+
+	// Workers number themselves from 1, the calling thread is 0
+	workerCount = count;
+	currentWorker = 0;
+	running = 1;
+	nextWorker = 0;
+	for (unsigned w = 1; w < count; w++)
+		if (!thr_create(&workers[w].thread, workerThread, NULL))
+		{
+			workerCount = w;
+			break;
+		}
+	return true;
+}
+
+void job_stop()
+{
+	if (!workers)
+		return;
+
+	thr_atomicStore(&running, 0);
+	thr_mutexLock(&sleepLock);
+	thr_condBroadcast(&wake);
+	thr_mutexUnlock(&sleepLock);
+
+	for (unsigned w = 1; w < workerCount; w++)
+		thr_join(workers[w].thread);
+
+	thr_queueDestroy(&background);
+	free(workers);
+	free(jobs);
+	workers = NULL;
+	jobs = NULL;
+	workerCount = 0;
+	currentWorker = -1;
+}
+
+unsigned job_workerCount()
+{
+	return workerCount > 0 ? workerCount : 1;
+}
+
+Job* job_create(Job* parent, JobFunc func, const void* data, size_t size)
+{
+	unsigned w = (unsigned)currentWorker;
+	Worker* worker = &workers[w];
+
+	// The pool wraps, a slot still in use means too many jobs in flight,
+	// help until it frees up
+	Job* job = &jobs[(size_t)w * JOB_POOL_SIZE + (worker->nextJob++ & (JOB_POOL_SIZE - 1))];
+	while (thr_atomicLoad(&job->unfinished) > 0)
+	{
+		Job* other = findJob(w);
+		if (other)
+			execute(other, w);
+		else
+			thr_yield();
+	}
+
+	job->func = func;
+	job->parent = parent;
+	job->unfinished = 1;
+	if (data)
+		memcpy(job->data, data, size);
+	if (parent)
+		thr_atomicAdd(&parent->unfinished, 1);
+	return job;
+}
+
+static void wakeOne()
+{
+	if (thr_atomicLoad(&sleepers) > 0)
+	{
+		thr_mutexLock(&sleepLock);
+		thr_condSignal(&wake);
+		thr_mutexUnlock(&sleepLock);
+	}
+}
+
+void job_run(Job* job)
+{
+	push(&workers[currentWorker], (long)(job - jobs));
+	wakeOne();
+}
+
+void job_runBackground(Job* job)
+{
+	// Full only with a whole pool of background jobs in flight, then the
+	// job goes wherever it fits
+	long index = (long)(job - jobs);
+	if (workerCount < 2)
+		execute(job, (unsigned)currentWorker);
+	else if (!thr_queuePush(&background, &index))
+		job_run(job);
+	else
+		wakeOne();
+}
+
+void job_wait(Job* job)
+{
+	unsigned w = (unsigned)currentWorker;
+	Worker* worker = &workers[w];
+
+	while (thr_atomicLoad(&job->unfinished) > 0)
+	{
+		Job* other = findJob(w);
+		if (other)
+		{
+			endIdle(worker);
+			execute(other, w);
+			continue;
+		}
+
+		beginIdle(worker);
+		thr_yield();
+	}
+	endIdle(worker);
+}
+
+typedef struct ParallelRange
+{
+	ParallelFunc func;
+	void* data;
+	size_t start;
+	size_t count;
+	size_t grain; // indices run without splitting further
+} ParallelRange;
+
+static void parallelRange(Job* job, unsigned worker)
+{
+	ParallelRange range;
+	memcpy(&range, job->data, sizeof(range));
+
+	// Hand off the upper half until one grain is left, thieves take the
+	// oldest and so the largest halves
+	while (range.count > range.grain)
+	{
+		ParallelRange upper = range;
+		upper.start = range.start + range.count / 2;
+		upper.count = range.count - range.count / 2;
+		range.count /= 2;
+		job_run(job_create(job, parallelRange, &upper, sizeof(upper)));
+	}
+
+	for (size_t i = range.start; i < range.start + range.count; i++)
+		range.func(i, worker, range.data);
+}
+
+void job_parallelFor(size_t count, ParallelFunc func, void* data)
+{
+	if (!workers || currentWorker < 0)
+	{
+		for (size_t i = 0; i < count; i++)
+			func(i, 0, data);
+		return;
+	}
+
+	ParallelRange range = { func, data, 0, count, count / (workerCount * 4) };
+	if (range.grain < 1)
+		range.grain = 1;
+
+	Job* root = job_create(NULL, parallelRange, &range, sizeof(range));
+	job_run(root);
+	job_wait(root);
+}
+
+void job_stats(JobStats* stats)
+{
+	if (!workers)
+	{
+		memset(stats, 0, sizeof(JobStats));
+		return;
+	}
+
+	double now = thr_time();
+	for (unsigned w = 0; w < workerCount; w++)
+	{
+		stats[w] = workers[w].stats;
+		double idleSince = workers[w].idleSince;
+		if (idleSince != 0.0)
+			stats[w].idleSeconds += now - idleSince;
+	}
+}
\ No newline at end of file
@@ -0,0 +1,57 @@
+#pragma once
+#include "thread.h"
+
+// Work-stealing job system shared by everything that runs beside the main thread
+// Every worker owns a deque of jobs. It pushes and pops at the bottom while
+// workers without work steal from the top of the others, after Chase and
+// Lev, so workers never share a lock. A job counts itself and its
+// unfinished children and is done when that reaches zero, job_wait runs
+// other jobs in the meantime instead of blocking. The main thread is worker 0
+#define JOB_POOL_SIZE 4096 // jobs in flight per worker, a power of two
+#define JOB_DATA_SIZE 48
+
+typedef struct Job Job;
+typedef void (*JobFunc)(Job* job, unsigned worker);
+
+struct Job
+{
+	JobFunc func;
+	Job* parent;
+	volatile long unfinished; // the job itself and its unfinished children
+	unsigned char data[JOB_DATA_SIZE]; // copied in by job_create
+};
+
+typedef struct JobStats
+{
+	size_t jobs;        // run by the worker
+	size_t steals;      // of those, taken from another worker
+	double idleSeconds; // looking for work and not finding any
+} JobStats;
+
+// Starts workerCount - 1 threads beside the calling one, 0 is one worker per core
+bool job_start(unsigned workerCount);
+void job_stop();
+// Workers including the main thread, 1 before job_start
+unsigned job_workerCount();
+
+// Only from the thread that called job_start or from inside a job
+// parent, when not NULL, isn't done until the new job is. size is at most
+// JOB_DATA_SIZE
+Job* job_create(Job* parent, JobFunc func, const void* data, size_t size);
+// Makes job available to every worker
+void job_run(Job* job);
+// For long jobs the main thread shouldn't end up running while it waits on
+// short ones. Only the other workers take them, oldest first. Runs job
+// right away when there are no other workers
+void job_runBackground(Job* job);
+// Runs other jobs until job and its children are done
+void job_wait(Job* job);
+
+// Runs func(i, worker, data) for every i in [0, count) and returns once
+// every index is done. worker is below job_workerCount(), for per-worker
+// scratch memory. Runs everything on the calling thread before job_start
+typedef void (*ParallelFunc)(size_t i, unsigned worker, void* data);
+void job_parallelFor(size_t count, ParallelFunc func, void* data);
+
+// Totals since job_start, job_workerCount() entries
+void job_stats(JobStats* stats);
\ No newline at end of file
@@ -12,8 +12,13 @@
 #include <stdarg.h>
 
 #include "gl_helper.h"
-
-#include "perlin.h"
+#include "terrain.h"
+#include "jobs.h"
+#include "world.h"
+#include "cdlod.h"
+#include "clipmap.h"
+#include "horizon.h"
+#include "quality.h"
 
 void resize(GLFWwindow* window, int width, int height)
 {
@@ -21,22 +26,6 @@ void resize(GLFWwindow* window, int width, int height)
 }
 
 
-float noiseMod(float height)
-{
-	return height * 250.f;
-}
-
-float noise(float x, float z)
-{
-	float perlin = Perlin_Get2d(x, z, 0.0001f, 5);
-	float pow = powf(perlin * 2.f - 1.f, 3.f) / 2.f + 0.5f;
-	if (perlin <= 0.5f)
-		return lerp(pow, perlin, 0.75f);
-	else
-		return pow;
-}
-
-
 void applyPhysics(Object* object, float gravity)
 {
 	float ground = noiseMod(noise(object->trans.pos.x * 100.f, object->trans.pos.z * 100.f));
@@ -67,7 +56,7 @@ void applyPhysics(Object* object, float gravity)
 	}
 
 	object->inWater = false;
-	if (object->trans.pos.y < 124.75f)
+	if (object->trans.pos.y < seaLevel)
 	{
 		object->inWater = true;
 	}
@@ -144,158 +133,231 @@ void playerInput(GLFWwindow* window, Object* camera, float moveSpeed,
 
 void setTitle(GLFWwindow* window, char* fmt, ...)
 {
-	char titleBuf[100];
+	char titleBuf[512];
 
 	va_list args;
 	va_start(args, fmt);
-	vsnprintf(titleBuf, 100, fmt, args);
+	vsnprintf(titleBuf, 512, fmt, args);
 	va_end(args);
 
 	glfwSetWindowTitle(window, titleBuf);
 }
 
 
-// 0.2 is min ocean
-// 0.4 is avg min ocean
-// 0.5 is max ocean
-RGB colorFromHeight(float height)
+// The bands around sea level are only 0.001 wide, so the gradient only
+// covers the heights where the ramp changes and clamps outside of it
+const float gradientMin = 0.3f;
+const float gradientMax = 0.7f;
+const size_t gradientSize = 2048;
+
+typedef enum Renderer
 {
-	RGB color = { 0 };
-
-	const RGB deepColor = {0.f, 0.f, 0.05f};
-	const RGB waterColor = {0.f, 0.f, 0.25f};
-	const RGB sandColor = {0.5f, 0.5f, 0.35f};
-	const RGB grassColor = {0.35f, 0.5f, 0.15f};
-	const RGB coldColor = {0.f, 0.25f, 0.15f};
-	const RGB stoneColor = {0.25f, 0.25f, 0.25f};
-	const RGB snowColor = {0.7f, 0.7f, 0.8f};
-
-	const float deepHeight = 0.45f;
-	const float waterHeight = 0.499f;
-	const float sandHeight = 0.50f;
-	const float grassHeight = 0.501;
-	const float coldHeight = 0.52f;
-	const float stoneHeight = 0.58f;
-	const float snowHeight = 0.64f;
-
-	if (height <= waterHeight)
-	{
-		float value = (height - deepHeight) / (waterHeight - deepHeight);
-		color = lerpRGB(waterColor, deepColor, value);
-	}
-	else if (height <= sandHeight)
-	{
-		float value = (height - waterHeight) / (sandHeight - waterHeight);
-		color = lerpRGB(sandColor, waterColor, value);
-	}
-	else if (height <= grassHeight)
-	{
-		float value = (height - sandHeight) / (grassHeight - sandHeight);
-		color = lerpRGB(grassColor, sandColor, value);
-	}
-	else if (height <= coldHeight)
-	{
-		float value = (height - grassHeight) / (coldHeight - grassHeight);
-		color = lerpRGB(coldColor, grassColor, value);
-	}
-	else if (height <= stoneHeight)
-	{
-		float value = (height - coldHeight) / (stoneHeight - coldHeight);
-		color = lerpRGB(stoneColor, coldColor, value);
-	}
-	else if (height <= snowHeight)
+	RENDER_CHUNKS, // world, one model per chunk
+	RENDER_CDLOD,  // quadtree with morphing levels
+	RENDER_CLIPMAP, // nested rings around the camera
+	RENDER_COUNT
+} Renderer;
+
+const char* rendererNames[RENDER_COUNT] = { "Chunks", "CDLOD", "Clipmap" };
+
+// Low afternoon sun, the shader normalizes it
+const Vec3f lightDir = { 0.6f, 0.5f, 0.4f };
+const float ambient = 0.35f;
+
+void makeContextCurrent(void* window)
+{
+	glfwMakeContextCurrent(window);
+}
+
+// Sums every worker's totals, stats has job_workerCount() entries
+JobStats totalJobStats(JobStats* stats)
+{
+	job_stats(stats);
+	JobStats total = { 0 };
+	for (unsigned w = 0; w < job_workerCount(); w++)
 	{
-		float value = (height - stoneHeight) / (snowHeight - stoneHeight);
-		color = lerpRGB(snowColor, stoneColor, value);
+		total.jobs += stats[w].jobs;
+		total.steals += stats[w].steals;
+		total.idleSeconds += stats[w].idleSeconds;
 	}
-	else
+	return total;
+}
+
+GLuint loadTerrainGradient()
+{
+	RGB* colors = malloc(sizeof(RGB) * gradientSize);
+	if (!colors)
+		return 0;
+
+	for (size_t i = 0; i < gradientSize; i++)
 	{
-		color = snowColor;
+		// Sample at texel centers so linear filtering lines up with the ramp
+		float height = gradientMin + (gradientMax - gradientMin) * (i + 0.5f) / gradientSize;
+		colors[i] = colorFromHeight(height);
+		colors[i].r = clampf(0.f, colors[i].r, 1.f);
+		colors[i].g = clampf(0.f, colors[i].g, 1.f);
+		colors[i].b = clampf(0.f, colors[i].b, 1.f);
 	}
 
-	return color;
+	GLuint gradient = glh_loadGradient(colors, gradientSize);
+	free(colors);
+
+	return gradient;
+}
+
+void drawWater(GLuint vao)
+{
+	// Seen from below when swimming, so both faces are drawn
+	glDisable(GL_CULL_FACE);
+	glBindVertexArray(vao);
+	glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+	glEnable(GL_CULL_FACE);
 }
 
-Model generateWorld(float x, float z, int lod)
+// Camera, lighting and gradient, shared by every terrain shader
+void setTerrainUniforms(GLuint shader, Object* camera, GLuint gradient, float fov, float viewDist)
 {
-	Model model = { 0 };
+	glUseProgram(shader);
+	glh_updateCamera(shader, camera, fov, viewDist);
+	glh_setUniformFloat(shader, "seaLevel", seaLevel);
+	glh_setUniformFloat(shader, "gradientMin", gradientMin);
+	glh_setUniformFloat(shader, "gradientMax", gradientMax);
+	glh_setUniformVec3(shader, "lightDir", lightDir);
+	glh_setUniformFloat(shader, "ambient", ambient);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_1D, gradient);
+}
 
-	lod = max(min(lod, 8), 1);
+void drawWorld(GLuint shader, World* world)
+{
+	for (int i = 0; i < world->size * world->size; i++)
+		if (world->chunks[i].model.vao)
+			gls_drawModel(shader, world->chunks[i].model);
+}
 
-	float step = 5.f * powf(1.75f, lod);
-	float size = 1000.f;
+// Loads the same world in every mesh mode, then as CDLOD and as a clipmap,
+// and renders it from spawn, printing the time until the first frame can be
+// drawn and until full detail, memory, ACMR and GPU time per frame
+void benchmark(GLFWwindow* window, GLuint shader, GLuint clipmapShader, GLuint gradient, World* world, float fov, float viewDist)
+{
+	const int frames = 200;
 
-	float xx = x * size * 2.f;
-	float zz = z * size * 2.f;
-	float scale = 0.01f;
-	//printf("Gen Chunk (%f, %f)\n", scale * xx, scale * zz);
+	Object camera = { 0 };
+	camera.trans.pos.y = noiseMod(noise(0.f, 0.f)) + 2.f;
+	camera.trans.rot.x = -10.f;
 
-	// I do not care how bad this is
-	for (float z = -size; z < size; z += step)
-		for (float x = -size; x < size; x += step)
-			model.count += 6;
+	GLuint query = 0;
+	glGenQueries(1, &query);
 
-	Vertex* verts = malloc(sizeof(Vertex) * model.count);
-	if (!verts)
+	setTerrainUniforms(clipmapShader, &camera, gradient, fov, viewDist);
+	setTerrainUniforms(shader, &camera, gradient, fov, viewDist);
+
+	printf("%-10s %10s %10s %8s %10s %10s %8s %12s\n", "Mode", "First ms", "Full ms", "Allocs", "#Tri", "MB", "ACMR", "GPU ms/frame");
+	// One row per mesh mode, then one per other renderer
+	for (int mode = 0; mode < MESH_MODE_COUNT + RENDER_COUNT - 1; mode++)
 	{
-		model.count = 0;
-		return model;
-	}
+		Renderer renderer = mode < MESH_MODE_COUNT ? RENDER_CHUNKS : RENDER_CDLOD + mode - MESH_MODE_COUNT;
+		Cdlod cdlod = { 0 };
+		Clipmap clipmap = { 0 };
+
+		long allocStart = arena_heapAllocs();
+		double buildStart = glfwGetTime();
+		double firstTime = 0.0;
+		if (renderer == RENDER_CLIPMAP)
+		{
+			if (!clipmap_create(&clipmap, viewDist))
+				break;
+			clipmap_update(&clipmap, camera.trans.pos);
+			glFinish();
+			firstTime = glfwGetTime() - buildStart;
+		}
+		else if (renderer == RENDER_CDLOD)
+		{
+			if (!cdlod_create(&cdlod, world->size * CHUNK_WORLD_SIZE * 0.5f, viewDist))
+				break;
+
+			// Refine until nothing is missing, a full circle fov turns culling
+			// off like for the chunks
+			cdlod_update(&cdlod, camera.trans.pos, camera.trans.rot.y, 360.f);
+			glFinish();
+			firstTime = glfwGetTime() - buildStart;
+			while (cdlod.built)
+				cdlod_update(&cdlod, camera.trans.pos, camera.trans.rot.y, 360.f);
+		}
+		else
+		{
+			world_load(world, mode, camera.trans.pos, camera.trans.rot.y, fov);
+			glFinish();
+			firstTime = glfwGetTime() - buildStart;
+			while (!world_refined(world))
+				world_update(world, camera.trans.pos, vec3f(0.f, 0.f, 0.f), camera.trans.rot.y, fov);
+		}
+		glFinish();
+		double buildTime = glfwGetTime() - buildStart;
+
+		size_t triangles = 0;
+		size_t bytes = 0;
+		float acmrSum = 0.f;
+		for (int i = 0; i < world->size * world->size && renderer == RENDER_CHUNKS; i++)
+		{
+			Model* model = &world->chunks[i].model;
+			triangles += model->triangles;
+			bytes += model->gpuBytes;
+			acmrSum += model->acmr * model->triangles;
+		}
+
+		GLuint64 gpuTime = 0;
+		for (int frame = 0; frame < frames; frame++)
+		{
+			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-	size_t pos = 0;
-	for (float z = -size; z < size; z += step)
-	{		
-		float y00;
-		float y01;
-		float y10;
-		float y11;
+			glBeginQuery(GL_TIME_ELAPSED, query);
+			if (renderer == RENDER_CLIPMAP)
+			{
+				glUseProgram(clipmapShader);
+				clipmap_draw(&clipmap, clipmapShader);
+				glUseProgram(shader);
+			}
+			else if (renderer == RENDER_CDLOD)
+				cdlod_draw(&cdlod, shader, camera.trans.pos);
+			else
+				drawWorld(shader, world);
+			glEndQuery(GL_TIME_ELAPSED);
 
-		float oldZ = z - step;
-		if (z + step >= size)
-			z = size;
+			GLuint64 frameTime = 0;
+			glGetQueryObjectui64v(query, GL_QUERY_RESULT, &frameTime);
+			gpuTime += frameTime;
 
-		y00 = 0.f;
-		y01 = 0.f;
-		y10 = noise(xx - size - step, zz + oldZ);
-		y11 = noise(xx - size - step, zz + z);
+			glfwSwapBuffers(window);
+			glfwPollEvents();
+		}
 
-		for (float x = -size; x < size; x += step)
+		if (renderer == RENDER_CLIPMAP)
 		{
-			float oldX = x - step;
-			if (x + step >= size)
-				x = size;
-
-			y00 = y10;
-			y01 = y11;
-			y10 = noise(xx + x, zz + oldZ);
-			y11 = noise(xx + x, zz + z);
-
-			verts[pos + 0].pos = vec3f(scale * (xx + oldX), noiseMod(y01), scale * (zz + z));
-			verts[pos + 0].rgb = colorFromHeight(y01);
-			verts[pos + 1].pos = vec3f(scale * (xx + x), noiseMod(y11), scale * (zz + z));
-			verts[pos + 1].rgb = colorFromHeight(y11);
-			verts[pos + 2].pos = vec3f(scale * (xx + oldX), noiseMod(y00), scale * (zz + oldZ));
-			verts[pos + 2].rgb = colorFromHeight(y00);
-
-			verts[pos + 3].pos = vec3f(scale * (xx + oldX), noiseMod(y00), scale * (zz + oldZ));
-			verts[pos + 3].rgb = colorFromHeight(y00);
-			verts[pos + 4].pos = vec3f(scale * (xx + x), noiseMod(y11), scale * (zz + z));
-			verts[pos + 4].rgb = colorFromHeight(y11);
-			verts[pos + 5].pos = vec3f(scale * (xx + x), noiseMod(y10), scale * (zz + oldZ));
-			verts[pos + 5].rgb = colorFromHeight(y10);
-
-			pos += 6;
+			// The ring indices are vertex cache optimized like the chunks,
+			// but without vertex data there's no ACMR to compare
+			triangles = clipmap.triangles;
+			bytes = clipmap.gpuBytes;
+			clipmap_destroy(&clipmap);
+		}
+		else if (renderer == RENDER_CDLOD)
+		{
+			triangles = cdlod.triangles;
+			bytes = cdlod.gpuBytes;
+			acmrSum = cdlod.acmr * triangles;
+			cdlod_destroy(&cdlod);
 		}
-	}
 
-	model = glh_loadModel(verts, model.count);
-	free(verts);
+		printf("%-10s %10.1f %10.1f %8ld %10llu %10.2f %8.2f %12.3f\n", renderer == RENDER_CHUNKS ? meshModeNames[mode] : rendererNames[renderer],
+			firstTime * 1000.0, buildTime * 1000.0, arena_heapAllocs() - allocStart, (unsigned long long)triangles, bytes / (1024.0 * 1024.0),
+			triangles ? acmrSum / triangles : 0.f, gpuTime / 1000000.0 / frames);
+	}
 
-	return model;
+	glDeleteQueries(1, &query);
 }
 
 
-int main()
+int main(int argc, char** argv)
 {
 	glfwInit();
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
@@ -315,8 +377,11 @@ int main()
 	glEnable(GL_CULL_FACE);
 	glFrontFace(GL_CCW);
 	glEnable(GL_DEPTH_TEST);
+	// Terrain fades out into the horizon panorama behind it
 	glEnable(GL_BLEND);
-	glBlendFunc(GL_SRC_ALPHA, GL_ZERO);
+	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	glEnable(GL_PRIMITIVE_RESTART);
+	glPrimitiveRestartIndex(RESTART_INDEX);
 
 	double timeNow = glfwGetTime();
 	double timeLast = glfwGetTime();
@@ -329,25 +394,103 @@ int main()
 	double timeFPSLast = glfwGetTime();
 	
 	GLuint shader = glh_loadShader("src/shader.vert", "src/shader.frag");
+	GLuint clipmapShader = glh_loadShader("src/clipmap.vert", "src/clipmap.frag");
+	GLuint gradient = loadTerrainGradient();
+
+	// The water plane is built from gl_VertexID, it only needs an empty vao
+	GLuint waterShader = glh_loadShader("src/water.vert", "src/water.frag");
+	GLuint waterVao = 0;
+	glGenVertexArrays(1, &waterVao);
+
+	GLuint horizonShader = glh_loadShader("src/horizon.vert", "src/horizon.frag");
+
+	// Before anything that sizes per-worker scratch memory. Without it
+	// everything runs on this thread and chunks are built in world_update
+	if (!job_start(0))
+		printf("Job system unavailable, building chunks on the render thread\n");
+	JobStats* jobStats = calloc(job_workerCount(), sizeof(JobStats));
+	JobStats jobsLast = { 0 };
+	double jobsPerSecond = 0.0;
+	double stolenPercent = 0.0;
+	double idlePercent = 0.0;
+	size_t popInsLast = 0;
+	double popInsPerSecond = 0.0;
 
 	float viewDist = 250.f;
+	float farDist = 2000.f;
+	float fov = 120.f;
+
+	MeshMode meshMode = MESH_ADAPTIVE;
+	float meshError = 0.02f;
 
 	int worldSize = viewDist / 10.f;
-	Model* world = malloc(sizeof(Model) * worldSize * worldSize);
-	for (int z = 0; z < worldSize; z++)
-		for (int x = 0; x < worldSize; x++)
+	World world;
+	world_create(&world, worldSize, meshMode, meshError);
+	// Far more than the default view distance needs, a ceiling for long
+	// sessions rather than a target
+	world.gpuBudget = 128 << 20;
+	world.cpuBudget = 256 << 20;
+
+	// Time from starting a load until the first frame and until every
+	// chunk is at its lod, printed once per load. The first one also counts
+	// opening the cache and starting the uploader
+	double loadStart = glfwGetTime();
+	bool firstFrameShown = false;
+	bool fullDetailShown = false;
+
+	// Meshes from earlier runs load without any noise, the file starts over
+	// by itself when the generator changed
+	ChunkCache chunkCache;
+	bool cacheOpen = cache_open(&chunkCache, "chunks.cache");
+	if (cacheOpen)
+		world.cache = &chunkCache;
+	printf("Chunk cache %s, %zu meshes\n", cacheOpen ? "open" : "unavailable", chunkCache.mapped.count);
+
+	// Chunk buffers are filled on a thread of their own, through a hidden
+	// window whose context shares objects with this one
+	bool uploadThread = true;
+	GLFWwindow* uploadWindow = NULL;
+	if (uploadThread)
+	{
+		glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+		uploadWindow = glfwCreateWindow(1, 1, "upload", NULL, window);
+		glfwWindowHint(GLFW_VISIBLE, GLFW_TRUE);
+		if (uploadWindow && !world_startUploader(&world, makeContextCurrent, uploadWindow))
 		{
-			int lod = max(abs(x - worldSize / 2), abs(z - worldSize / 2));
-			world[x + z * worldSize] = generateWorld(x - worldSize / 2, z - worldSize / 2, lod);
+			glfwDestroyWindow(uploadWindow);
+			uploadWindow = NULL;
 		}
+		printf("Upload thread %s\n", uploadWindow ? "running" : "unavailable, uploading on the render thread");
+	}
 
 	Object camera = { 0 };
+	world_load(&world, meshMode, camera.trans.pos, camera.trans.rot.y, fov);
+
+	Renderer renderer = RENDER_CHUNKS;
+	Cdlod cdlod;
+	cdlod_create(&cdlod, worldSize * CHUNK_WORLD_SIZE * 0.5f, viewDist);
+	Clipmap clipmap;
+	clipmap_create(&clipmap, viewDist);
+	Horizon horizon;
+	horizon_create(&horizon, viewDist, farDist);
+
+	// Starts at full quality, the world and everything else were sized for
+	// the largest view distance
+	Quality quality;
+	quality_create(&quality, 1000.0 / 60.0, world.pixelError, world.pixelError * 4.f, viewDist * 0.6f, viewDist);
+	double frameLast = glfwGetTime();
+
 	float moveSpeed = 0.0075f;
 	float sprintSpeed = 0.02f;
 	float jumpHeight = 0.3f;
 	float gravity = -0.03f;
 	float lookSpeed = 0.1f;
-	float fov = 120.f;
+
+	if (argc > 1 && strcmp(argv[1], "--bench") == 0)
+	{
+		benchmark(window, shader, clipmapShader, gradient, &world, fov, viewDist);
+		glfwSetWindowShouldClose(window, true);
+	}
 
 	bool paused = false;
 	bool escLast = false;
@@ -356,6 +499,8 @@ int main()
 
 	bool wireframe = false;
 	bool tLast = false;
+	bool mLast = false;
+	bool rLast = false;
 
 	while (!glfwWindowShouldClose(window))
 	{
@@ -370,6 +515,22 @@ int main()
 		}
 		tLast = tPressed;
 
+		bool mPressed = glfwGetKey(window, GLFW_KEY_M);
+		if (mPressed && !mLast)
+		{
+			meshMode = (meshMode + 1) % MESH_MODE_COUNT;
+			loadStart = glfwGetTime();
+			firstFrameShown = false;
+			fullDetailShown = false;
+			world_load(&world, meshMode, camera.trans.pos, camera.trans.rot.y, fov);
+		}
+		mLast = mPressed;
+
+		bool rPressed = glfwGetKey(window, GLFW_KEY_R);
+		if (rPressed && !rLast)
+			renderer = (renderer + 1) % RENDER_COUNT;
+		rLast = rPressed;
+
 		bool escape = glfwGetKey(window, GLFW_KEY_ESCAPE);
 		if (escape && !escLast)
 		{
@@ -397,53 +558,147 @@ int main()
 			applyPhysics(&camera, gravity);
 		}
 		timeLast = timeNow;
-		glh_updateCamera(shader, &camera, fov, viewDist);
+
+		// Velocity is per physics step, the world wants it per second
+		float steps = (float)(1.0 / updateTime);
+		Vec3f camVel = vec3f(camera.vel.x * steps, camera.vel.y * steps, camera.vel.z * steps);
+		if (renderer == RENDER_CHUNKS)
+			world_update(&world, camera.trans.pos, camVel, camera.trans.rot.y, fov);
+		else if (renderer == RENDER_CDLOD)
+			cdlod_update(&cdlod, camera.trans.pos, camera.trans.rot.y, fov);
+		else
+			clipmap_update(&clipmap, camera.trans.pos);
+
+		quality_beginFrame(&quality);
+
+		if (horizon_stale(&horizon, camera.trans.pos))
+		{
+			setTerrainUniforms(shader, &camera, gradient, fov, viewDist);
+			horizon_capture(&horizon, camera.trans.pos, shader, waterShader);
+		}
 
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-		glUseProgram(shader);
+		glUseProgram(horizonShader);
+		glh_updateCamera(horizonShader, &camera, fov, viewDist);
+		horizon_draw(&horizon, horizonShader);
+
+		// Water goes first so the seafloor behind it fails the depth test early
+		glUseProgram(waterShader);
+		glh_updateCamera(waterShader, &camera, fov, viewDist);
+		glh_setUniformFloat(waterShader, "seaLevel", seaLevel);
+		drawWater(waterVao);
+
+		setTerrainUniforms(renderer == RENDER_CLIPMAP ? clipmapShader : shader, &camera, gradient, fov, viewDist);
 
 		size_t triCount = 0;
-		for (int z = 0; z < worldSize; z++)
-			for (int x = 0; x < worldSize; x++)
-			{
-				float cX = (x - worldSize / 2) * 20.f;
-				float cZ = (z - worldSize / 2) * 20.f;
+		size_t gridTriCount = 0;
+		float acmrSum = 0.f;
+		if (renderer == RENDER_CLIPMAP)
+		{
+			clipmap_draw(&clipmap, clipmapShader);
+			triCount = clipmap.triangles;
+			gridTriCount = clipmap.triangles;
+		}
+		else if (renderer == RENDER_CDLOD)
+		{
+			cdlod_draw(&cdlod, shader, camera.trans.pos);
+			triCount = cdlod.triangles;
+			gridTriCount = cdlod.triangles;
+			acmrSum = cdlod.acmr * cdlod.triangles;
+		}
+		else
+		{
+			for (int z = 0; z < worldSize; z++)
+				for (int x = 0; x < worldSize; x++)
+				{
+					Chunk* chunk = &world.chunks[x + z * worldSize];
+					float cX = chunk->x * CHUNK_WORLD_SIZE;
+					float cZ = chunk->z * CHUNK_WORLD_SIZE;
 
-				float pX = camera.trans.pos.x;
-				float pZ = camera.trans.pos.z;
+					float pX = camera.trans.pos.x;
+					float pZ = camera.trans.pos.z;
 
-				float dist = pow2f(cX - pX) + pow2f(cZ - pZ);
-				if (dist > pow2f(viewDist))
-					continue;
+					float dist = pow2f(cX - pX) + pow2f(cZ - pZ);
+					if (dist > pow2f(viewDist))
+						continue;
 				
-				pX += sinf(toRad(camera.trans.rot.y)) * 20.f;
-				pZ += cosf(toRad(camera.trans.rot.y)) * 20.f;
+					pX += sinf(toRad(camera.trans.rot.y)) * 20.f;
+					pZ += cosf(toRad(camera.trans.rot.y)) * 20.f;
 				
-				float angleDiff = fmodf(camera.trans.rot.y - 
-					toDeg(fastAtan2(pX - cX, pZ - cZ)) + 
-					180.f + 360.f, 360.f) - 180.f;
+					float angleDiff = fmodf(camera.trans.rot.y - 
+						toDeg(fastAtan2(pX - cX, pZ - cZ)) + 
+						180.f + 360.f, 360.f) - 180.f;
 				
-				if (angleDiff <= fov * 0.667f && angleDiff >= -fov * 0.667f)
-				{
-					gls_drawModel(world[x + z * worldSize]);
-					triCount += world[x + z * worldSize].count;
+					Model* model = &chunk->model;
+
+					// Recycled slot still waiting for its first mesh
+					if (!model->vao)
+						continue;
+
+					// Entirely under opaque water
+					if (model->maxHeight < seaLevel && camera.trans.pos.y >= seaLevel)
+						continue;
+
+					if (angleDiff <= fov * 0.667f && angleDiff >= -fov * 0.667f)
+					{
+						gls_drawModel(shader, *model);
+						triCount += model->triangles;
+						acmrSum += model->acmr * model->triangles;
+
+						size_t cells = model->gridSize - 1;
+						gridTriCount += cells * cells * 2;
+					}
 				}
-			}
+		}
+
+		double frameNow = glfwGetTime();
+		if (quality_endFrame(&quality, (frameNow - frameLast) * 1000.0))
+		{
+			viewDist = quality.viewDist;
+			world.pixelError = quality.pixelError;
+			horizon_setViewDist(&horizon, viewDist);
+		}
+		frameLast = frameNow;
 
 		glfwSwapBuffers(window);
 
-		setTitle(window, "FPS:%4u | #Tri: %llu | Pos(%.2f, %.2f, %.2f) | Rot(%.2f, %.2f) | ViewDist: %.2f", 
-			fps, triCount / 3,
+		if (!firstFrameShown)
+		{
+			printf("First frame after %.1f ms\n", (glfwGetTime() - loadStart) * 1000.0);
+			firstFrameShown = true;
+		}
+		if (!fullDetailShown && world_refined(&world))
+		{
+			printf("Full detail after %.1f ms\n", (glfwGetTime() - loadStart) * 1000.0);
+			fullDetailShown = true;
+		}
+
+		setTitle(window, "FPS:%4u | #Tri: %llu/%llu (%s) | ACMR: %.2f | Allocs: %ld | Builds: %zu/%zu | Upload: %zu KB | Pop-in: %.1f/s %zu late | Mem: %.1f/%.1f MB (gpu/cpu) %zu downgraded | Wasted: %.0f%% %zu/%zu/%zu (dropped/cancelled/discarded) | Jobs: %.0f/s %.0f%%/%.0f%% (stolen/idle) | Pos(%.2f, %.2f, %.2f) | Rot(%.2f, %.2f) | ViewDist: %.2f | Frame: %.1f/%.1f ms (cpu/gpu) | PixelError: %.2f | Quality: %s %zu/%zu (lowered/raised)", 
+			fps, triCount, gridTriCount, renderer == RENDER_CHUNKS ? meshModeNames[meshMode] : rendererNames[renderer], triCount ? acmrSum / triCount : 0.f, arena_heapAllocs(),
+			world_pendingBuilds(&world), world.rebuilds, world.uploadBytes >> 10, popInsPerSecond, world.lateChunks,
+			world.gpuBytes / 1048576.0, world.cpuBytes / 1048576.0, world.downgraded,
+			world.buildMs > 0.0 ? world.wastedMs * 100.0 / world.buildMs : 0.0, world.cancelledQueued, world.cancelledRunning, world.discarded,
+			jobsPerSecond, stolenPercent, idlePercent,
 			camera.trans.pos.x, camera.trans.pos.y, camera.trans.pos.z,
 			camera.trans.rot.x, camera.trans.rot.y,
-			viewDist);
+			viewDist, quality.cpuMs, quality.gpuMs, quality.pixelError,
+			qualityDecisionNames[quality.decision], quality.lowered, quality.raised);
 
 		double timeFPSNow = glfwGetTime();
 		deltaFPS += timeFPSNow - timeFPSLast;
 		timeFPSLast = timeFPSNow;
 		if (deltaFPS >= 1.0)
 		{
+			JobStats jobsNow = totalJobStats(jobStats);
+			size_t jobsRun = jobsNow.jobs - jobsLast.jobs;
+			jobsPerSecond = jobsRun / deltaFPS;
+			stolenPercent = jobsRun ? (jobsNow.steals - jobsLast.steals) * 100.0 / jobsRun : 0.0;
+			idlePercent = (jobsNow.idleSeconds - jobsLast.idleSeconds) * 100.0 / (deltaFPS * job_workerCount());
+			jobsLast = jobsNow;
+			popInsPerSecond = (world.popIns - popInsLast) / deltaFPS;
+			popInsLast = world.popIns;
+
 			deltaFPS = 0.0;
 			fps = fpsCount;
 			fpsCount = 0;
@@ -453,11 +708,31 @@ int main()
 		glfwPollEvents();
 	}
 
-	for (int z = 0; z < worldSize; z++)
-		for (int x = 0; x < worldSize; x++)
-			glh_deleteModel(world[x + z * worldSize]);
-	free(world);
-
+	world_destroy(&world);
+	if (cacheOpen)
+	{
+		printf("Chunk cache: %ld hits, %ld misses, %zu KB added\n", chunkCache.hits, chunkCache.misses, chunkCache.storedBytes >> 10);
+		cache_close(&chunkCache);
+	}
+	if (uploadWindow)
+		glfwDestroyWindow(uploadWindow);
+	cdlod_destroy(&cdlod);
+	clipmap_destroy(&clipmap);
+	horizon_destroy(&horizon);
+	quality_destroy(&quality);
+
+	job_stats(jobStats);
+	printf("%-8s %10s %10s %10s\n", "Worker", "Jobs", "Steals", "Idle s");
+	for (unsigned w = 0; w < job_workerCount(); w++)
+		printf("%-8u %10zu %10zu %10.2f\n", w, jobStats[w].jobs, jobStats[w].steals, jobStats[w].idleSeconds);
+	free(jobStats);
+	job_stop();
+
+	glDeleteVertexArrays(1, &waterVao);
+	glDeleteProgram(waterShader);
+	glDeleteTextures(1, &gradient);
+	glDeleteProgram(horizonShader);
+	glDeleteProgram(clipmapShader);
 	glDeleteProgram(shader);
 	glfwDestroyWindow(window);
 	glfwTerminate();
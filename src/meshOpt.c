@@ -0,0 +1,346 @@
+#include "meshOpt.h"
+
+#define FORSYTH_CACHE_SIZE 32
+
+typedef struct ForsythScores
+{
+	float cache[FORSYTH_CACHE_SIZE + 1];
+	float valence[64];
+} ForsythScores;
+
+static void initForsyth(ForsythScores* scores)
+{
+	const float cacheDecayPower = 1.5f;
+	const float lastTriScore = 0.75f;
+	const float valenceBoostScale = 2.f;
+	const float valenceBoostPower = 0.5f;
+
+	for (int i = 0; i < FORSYTH_CACHE_SIZE; i++)
+	{
+		// The three most recent vertices get a fixed score so the
+		// next triangle does not simply reuse the last one's edge
+		if (i < 3)
+			scores->cache[i] = lastTriScore;
+		else
+			scores->cache[i] = powf(1.f - (i - 3) / (float)(FORSYTH_CACHE_SIZE - 3), cacheDecayPower);
+	}
+	scores->cache[FORSYTH_CACHE_SIZE] = 0.f;
+
+	scores->valence[0] = 0.f;
+	for (int i = 1; i < 64; i++)
+		scores->valence[i] = valenceBoostScale * powf((float)i, -valenceBoostPower);
+}
+
+static float forsythScore(const ForsythScores* scores, int cachePos, unsigned valence)
+{
+	if (valence == 0)
+		return -1.f;
+	return scores->cache[cachePos] + scores->valence[min(valence, 63)];
+}
+
+void optimizeVertexCache(uint32_t* indices, size_t indexCount, size_t vertCount, Arena* scratch)
+{
+	size_t triCount = indexCount / 3;
+	if (triCount < 2)
+		return;
+
+	unsigned* valence = arena_calloc(scratch, vertCount, sizeof(unsigned));
+	unsigned* adjOffset = arena_alloc(scratch, sizeof(unsigned) * (vertCount + 1));
+	uint32_t* adjacency = arena_alloc(scratch, sizeof(uint32_t) * indexCount);
+	int* cachePos = arena_alloc(scratch, sizeof(int) * vertCount);
+	float* vertScore = arena_alloc(scratch, sizeof(float) * vertCount);
+	float* triScore = arena_alloc(scratch, sizeof(float) * triCount);
+	bool* triAdded = arena_calloc(scratch, triCount, sizeof(bool));
+	uint32_t* output = arena_alloc(scratch, sizeof(uint32_t) * indexCount);
+	if (!valence || !adjOffset || !adjacency || !cachePos || !vertScore || !triScore || !triAdded || !output)
+		return;
+
+	ForsythScores scores;
+	initForsyth(&scores);
+
+	for (size_t i = 0; i < indexCount; i++)
+		valence[indices[i]]++;
+
+	adjOffset[0] = 0;
+	for (size_t v = 0; v < vertCount; v++)
+	{
+		adjOffset[v + 1] = adjOffset[v] + valence[v];
+		cachePos[v] = FORSYTH_CACHE_SIZE;
+		vertScore[v] = forsythScore(&scores, FORSYTH_CACHE_SIZE, valence[v]);
+	}
+
+	// valence is reused as the fill cursor, then restored as remaining count
+	memset(valence, 0, sizeof(unsigned) * vertCount);
+	for (size_t t = 0; t < triCount; t++)
+		for (int k = 0; k < 3; k++)
+		{
+			uint32_t v = indices[t * 3 + k];
+			adjacency[adjOffset[v] + valence[v]++] = (uint32_t)t;
+		}
+
+	size_t bestTri = 0;
+	for (size_t t = 0; t < triCount; t++)
+	{
+		triScore[t] = vertScore[indices[t * 3]] + vertScore[indices[t * 3 + 1]] + vertScore[indices[t * 3 + 2]];
+		if (triScore[t] > triScore[bestTri])
+			bestTri = t;
+	}
+
+	uint32_t cache[FORSYTH_CACHE_SIZE + 3];
+	int cacheCount = 0;
+	size_t scanPos = 0;
+
+	for (size_t out = 0; out < triCount; out++)
+	{
+		if (bestTri == (size_t)-1)
+		{
+			// Nothing in the cache has work left, take the next unused triangle
+			while (triAdded[scanPos])
+				scanPos++;
+			bestTri = scanPos;
+		}
+
+		triAdded[bestTri] = true;
+
+		uint32_t tri[3] = { indices[bestTri * 3], indices[bestTri * 3 + 1], indices[bestTri * 3 + 2] };
+		output[out * 3 + 0] = tri[0];
+		output[out * 3 + 1] = tri[1];
+		output[out * 3 + 2] = tri[2];
+
+		// Move the triangle's vertices to the front of the LRU cache
+		uint32_t newCache[FORSYTH_CACHE_SIZE + 3];
+		int newCount = 0;
+		for (int k = 0; k < 3; k++)
+		{
+			uint32_t v = tri[k];
+			newCache[newCount++] = v;
+
+			// Drop the triangle from the vertex's remaining list
+			unsigned* adj = adjacency + adjOffset[v];
+			for (unsigned a = 0; a < valence[v]; a++)
+				if (adj[a] == bestTri)
+				{
+					adj[a] = adj[valence[v] - 1];
+					break;
+				}
+			valence[v]--;
+		}
+		for (int c = 0; c < cacheCount; c++)
+		{
+			uint32_t v = cache[c];
+			if (v != tri[0] && v != tri[1] && v != tri[2])
+				newCache[newCount++] = v;
+		}
+
+		// Rescore everything that was or is in the cache and pick the best
+		// triangle touching it for the next round
+		float bestScore = -1.f;
+		bestTri = (size_t)-1;
+		for (int c = 0; c < newCount; c++)
+		{
+			uint32_t v = newCache[c];
+			cachePos[v] = c < FORSYTH_CACHE_SIZE ? c : FORSYTH_CACHE_SIZE;
+
+			float score = forsythScore(&scores, cachePos[v], valence[v]);
+			float delta = score - vertScore[v];
+			vertScore[v] = score;
+
+			unsigned* adj = adjacency + adjOffset[v];
+			for (unsigned a = 0; a < valence[v]; a++)
+			{
+				triScore[adj[a]] += delta;
+				if (triScore[adj[a]] > bestScore)
+				{
+					bestScore = triScore[adj[a]];
+					bestTri = adj[a];
+				}
+			}
+		}
+
+		cacheCount = min(newCount, FORSYTH_CACHE_SIZE);
+		memcpy(cache, newCache, sizeof(uint32_t) * cacheCount);
+	}
+
+	memcpy(indices, output, sizeof(uint32_t) * triCount * 3);
+}
+
+
+typedef struct Cluster
+{
+	size_t start, count;
+	Vec3f centroid;
+	Vec3f normal;
+	float sortKey;
+} Cluster;
+
+static int compareClusters(const void* l, const void* r)
+{
+	float left = ((const Cluster*)l)->sortKey;
+	float right = ((const Cluster*)r)->sortKey;
+	return (left < right) - (left > right);
+}
+
+static Vec3f meshVertex(const Mesh* mesh, uint32_t i)
+{
+	float cellScale = 1.f / (mesh->gridSize - 1);
+	return vec3f(
+		mesh->origin.x + (i % mesh->gridSize) * cellScale * mesh->scale.x,
+		mesh->origin.y + mesh->heights[i] / 65535.f * mesh->scale.y,
+		mesh->origin.z + (i / mesh->gridSize) * cellScale * mesh->scale.z);
+}
+
+void optimizeOverdraw(Mesh* mesh, Arena* scratch)
+{
+	size_t triCount = mesh->indexCount / 3;
+	if (triCount < 2)
+		return;
+
+	Cluster* clusters = arena_alloc(scratch, sizeof(Cluster) * triCount);
+	uint32_t* timestamps = arena_calloc(scratch, mesh->vertCount, sizeof(uint32_t));
+	uint32_t* output = arena_alloc(scratch, sizeof(uint32_t) * mesh->indexCount);
+	if (!clusters || !timestamps || !output)
+		return;
+
+	// A triangle with no vertex in the FIFO cache is a point where the
+	// cache order restarts anyway, cutting there costs (almost) nothing
+	const size_t minCluster = 32;
+	size_t clusterCount = 0;
+	uint32_t time = ACMR_CACHE_SIZE + 1;
+	for (size_t t = 0; t < triCount; t++)
+	{
+		int misses = 0;
+		for (int k = 0; k < 3; k++)
+		{
+			uint32_t v = mesh->indices[t * 3 + k];
+			if (time - timestamps[v] > ACMR_CACHE_SIZE)
+			{
+				timestamps[v] = time++;
+				misses++;
+			}
+		}
+
+		if (clusterCount == 0 || (misses == 3 && clusters[clusterCount - 1].count >= minCluster))
+		{
+			clusters[clusterCount].start = t;
+			clusters[clusterCount].count = 0;
+			clusterCount++;
+		}
+		clusters[clusterCount - 1].count++;
+	}
+
+	// Same heuristic as meshoptimizer: clusters facing away from the mesh
+	// centre are in front of the rest from most viewpoints
+	Vec3f meshCentroid = { 0 };
+	float meshArea = 0.f;
+	for (size_t c = 0; c < clusterCount; c++)
+	{
+		Vec3f centroid = { 0 };
+		Vec3f normal = { 0 };
+		float area = 0.f;
+
+		for (size_t t = clusters[c].start; t < clusters[c].start + clusters[c].count; t++)
+		{
+			Vec3f a = meshVertex(mesh, mesh->indices[t * 3 + 0]);
+			Vec3f b = meshVertex(mesh, mesh->indices[t * 3 + 1]);
+			Vec3f d = meshVertex(mesh, mesh->indices[t * 3 + 2]);
+
+			Vec3f n = cross(vec3f(b.x - a.x, b.y - a.y, b.z - a.z), vec3f(d.x - a.x, d.y - a.y, d.z - a.z));
+			float triArea = sqrtf(dot(n, n));
+
+			centroid.x += (a.x + b.x + d.x) / 3.f * triArea;
+			centroid.y += (a.y + b.y + d.y) / 3.f * triArea;
+			centroid.z += (a.z + b.z + d.z) / 3.f * triArea;
+			normal.x += n.x;
+			normal.y += n.y;
+			normal.z += n.z;
+			area += triArea;
+		}
+
+		if (area > 0.f)
+		{
+			centroid.x /= area;
+			centroid.y /= area;
+			centroid.z /= area;
+		}
+		float normalLength = sqrtf(dot(normal, normal));
+		if (normalLength > 0.f)
+		{
+			normal.x /= normalLength;
+			normal.y /= normalLength;
+			normal.z /= normalLength;
+		}
+
+		meshCentroid.x += centroid.x * area;
+		meshCentroid.y += centroid.y * area;
+		meshCentroid.z += centroid.z * area;
+		meshArea += area;
+
+		clusters[c].centroid = centroid;
+		clusters[c].normal = normal;
+	}
+
+	if (meshArea > 0.f)
+	{
+		meshCentroid.x /= meshArea;
+		meshCentroid.y /= meshArea;
+		meshCentroid.z /= meshArea;
+	}
+
+	for (size_t c = 0; c < clusterCount; c++)
+	{
+		Vec3f centroid = clusters[c].centroid;
+		clusters[c].sortKey = dot(vec3f(
+			centroid.x - meshCentroid.x,
+			centroid.y - meshCentroid.y,
+			centroid.z - meshCentroid.z), clusters[c].normal);
+	}
+
+	qsort(clusters, clusterCount, sizeof(Cluster), compareClusters);
+
+	size_t pos = 0;
+	for (size_t c = 0; c < clusterCount; c++)
+	{
+		memcpy(output + pos, mesh->indices + clusters[c].start * 3, sizeof(uint32_t) * clusters[c].count * 3);
+		pos += clusters[c].count * 3;
+	}
+	memcpy(mesh->indices, output, sizeof(uint32_t) * mesh->indexCount);
+}
+
+float computeACMR(const Mesh* mesh, Arena* scratch)
+{
+	if (!mesh->indices)
+		return 3.f;
+	if (mesh->triangles == 0)
+		return 0.f;
+
+	uint32_t* timestamps = arena_calloc(scratch, mesh->vertCount, sizeof(uint32_t));
+	if (!timestamps)
+		return 0.f;
+
+	size_t misses = 0;
+	uint32_t time = ACMR_CACHE_SIZE + 1;
+	for (size_t i = 0; i < mesh->indexCount; i++)
+	{
+		uint32_t v = mesh->indices[i];
+		if (v == RESTART_INDEX)
+			continue;
+
+		if (time - timestamps[v] > ACMR_CACHE_SIZE)
+		{
+			timestamps[v] = time++;
+			misses++;
+		}
+	}
+
+	return (float)misses / mesh->triangles;
+}
+
+void optimizeMesh(Mesh* mesh, Arena* scratch)
+{
+	if (mesh->indices && mesh->primitive == GL_TRIANGLES)
+	{
+		optimizeVertexCache(mesh->indices, mesh->indexCount, mesh->vertCount, scratch);
+		optimizeOverdraw(mesh, scratch);
+	}
+	mesh->acmr = computeACMR(mesh, scratch);
+}
\ No newline at end of file
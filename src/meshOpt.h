@@ -0,0 +1,25 @@
+#pragma once
+#include "gl_helper.h"
+#include "arena.h"
+
+// Temporaries come from the caller's scratch arena
+
+// Cache size the ACMR metric is simulated with, a FIFO like most GPUs
+#define ACMR_CACHE_SIZE 16
+
+// Reorders triangles for the post-transform vertex cache
+// (Forsyth, "Linear-Speed Vertex Cache Optimisation")
+void optimizeVertexCache(uint32_t* indices, size_t indexCount, size_t vertCount, Arena* scratch);
+
+// Splits the cache optimized order into clusters at cache restarts and
+// sorts them so likely occluders draw first, for less overdraw
+void optimizeOverdraw(Mesh* mesh, Arena* scratch);
+
+// Average cache miss ratio, transformed vertices per triangle
+// 0.5 is the ideal for a large grid, 3 means no reuse at all (soups)
+// Handles lists and restarted strips
+float computeACMR(const Mesh* mesh, Arena* scratch);
+
+// The whole optimization stage, fills mesh->acmr
+// Only indexed triangle lists are reordered
+void optimizeMesh(Mesh* mesh, Arena* scratch);
\ No newline at end of file
@@ -2,6 +2,11 @@
 
 #include <math.h>
 
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#define PERLIN_SSE2
+#include <emmintrin.h>
+#endif
+
 static const int  SEED = 1985;
 
 static const unsigned char  HASH[] = {
@@ -67,4 +72,71 @@ float Perlin_Get2d(float x, float y, float freq, int depth)
         ya *= 2;
     }
     return fin / div;
+}
+
+#ifdef PERLIN_SSE2
+static __m128 smooth_inter4(__m128 x, __m128 y, __m128 s)
+{
+    const __m128  s2 = _mm_mul_ps(s, s);
+    const __m128  t = _mm_mul_ps(s2, _mm_sub_ps(_mm_set1_ps(3.f), _mm_add_ps(s, s)));
+    return _mm_add_ps(x, _mm_mul_ps(t, _mm_sub_ps(y, x)));
+}
+
+// Four samples of noise2d sharing one y, only the hash lookups stay scalar
+static __m128 noise2d_row4(__m128 x, int y_int, __m128 y_frac)
+{
+    __m128i  x_int = _mm_cvttps_epi32(x);
+    // cvtt truncates towards zero, step down for negative fractions
+    x_int = _mm_add_epi32(x_int, _mm_castps_si128(_mm_cmplt_ps(x, _mm_cvtepi32_ps(x_int))));
+    const __m128  x_frac = _mm_sub_ps(x, _mm_cvtepi32_ps(x_int));
+
+    const int  row0 = HASH[(y_int + SEED) & 0b11111111];
+    const int  row1 = HASH[(y_int + 1 + SEED) & 0b11111111];
+
+    int  xs[4];
+    _mm_storeu_si128((__m128i*)xs, x_int);
+
+    float  s[4], t[4], u[4], v[4];
+    for (int i = 0; i < 4; i++)
+    {
+        s[i] = HASH[(row0 + xs[i]) & 0b11111111];
+        t[i] = HASH[(row0 + xs[i] + 1) & 0b11111111];
+        u[i] = HASH[(row1 + xs[i]) & 0b11111111];
+        v[i] = HASH[(row1 + xs[i] + 1) & 0b11111111];
+    }
+
+    const __m128  low = smooth_inter4(_mm_loadu_ps(s), _mm_loadu_ps(t), x_frac);
+    const __m128  high = smooth_inter4(_mm_loadu_ps(u), _mm_loadu_ps(v), x_frac);
+    return smooth_inter4(low, high, y_frac);
+}
+#endif
+
+void Perlin_Get2dRow(float* out, float x, float dx, float y, int count, float freq, int depth)
+{
+    int  i = 0;
+
+#ifdef PERLIN_SSE2
+    const __m128  lane = _mm_set_ps(3.f, 2.f, 1.f, 0.f);
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128  xa = _mm_mul_ps(_mm_add_ps(_mm_set1_ps(x + i * dx), _mm_mul_ps(lane, _mm_set1_ps(dx))), _mm_set1_ps(freq));
+        float  ya = y * freq;
+        float  amp = 1.f;
+        __m128  fin = _mm_setzero_ps();
+        float  div = 0.f;
+        for (int o = 0; o < depth; o++)
+        {
+            const int  y_int = floorf(ya);
+            div += 256 * amp;
+            fin = _mm_add_ps(fin, _mm_mul_ps(noise2d_row4(xa, y_int, _mm_set1_ps(ya - y_int)), _mm_set1_ps(amp)));
+            amp /= 2;
+            xa = _mm_add_ps(xa, xa);
+            ya *= 2;
+        }
+        _mm_storeu_ps(out + i, _mm_div_ps(fin, _mm_set1_ps(div)));
+    }
+#endif
+
+    for (; i < count; i++)
+        out[i] = Perlin_Get2d(x + i * dx, y, freq, depth);
 }
\ No newline at end of file
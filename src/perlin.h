@@ -3,4 +3,7 @@
 
 extern float Perlin_Get2d(float x, float y, float freq, int depth);
 
+// Perlin_Get2d for count samples along x, starting at x and dx apart
+extern void Perlin_Get2dRow(float* out, float x, float dx, float y, int count, float freq, int depth);
+
 #endif  // PERLIN_H
\ No newline at end of file
@@ -0,0 +1,139 @@
+#include "quality.h"
+
+#include <string.h>
+#include <math.h>
+
+const char* qualityDecisionNames[3] = { "Hold", "Lower", "Raise" };
+
+// Weight of the newest frame in the moving averages
+static const double averageWeight = 0.05;
+// Size of one step, as a factor on pixelError and viewDist
+static const float lodStep = 1.25f;
+static const float viewDistStep = 0.9f;
+
+bool quality_create(Quality* quality, double targetMs, float minPixelError, float maxPixelError,
+	float minViewDist, float maxViewDist)
+{
+	memset(quality, 0, sizeof(Quality));
+	quality->targetMs = targetMs;
+	quality->band = 0.15f;
+	quality->settleFrames = 60;
+	quality->minPixelError = minPixelError;
+	quality->maxPixelError = maxPixelError;
+	quality->minViewDist = minViewDist;
+	quality->maxViewDist = maxViewDist;
+	quality->pixelError = minPixelError;
+	quality->viewDist = maxViewDist;
+	quality->cpuMs = targetMs;
+	quality->gpuMs = 0.0;
+	quality->settle = quality->settleFrames;
+	quality->backoff = 1;
+
+	glGenQueries(QUALITY_QUERIES, quality->queries);
+	return true;
+}
+
+void quality_destroy(Quality* quality)
+{
+	glDeleteQueries(QUALITY_QUERIES, quality->queries);
+	memset(quality, 0, sizeof(Quality));
+}
+
+void quality_beginFrame(Quality* quality)
+{
+	glBeginQuery(GL_TIME_ELAPSED, quality->queries[quality->frame % QUALITY_QUERIES]);
+}
+
+static QualityDecision lower(Quality* quality)
+{
+	if (quality->pixelError < quality->maxPixelError)
+	{
+		quality->pixelError = fminf(quality->pixelError * lodStep, quality->maxPixelError);
+		return QUALITY_LOWER;
+	}
+	if (quality->viewDist > quality->minViewDist)
+	{
+		quality->viewDist = fmaxf(quality->viewDist * viewDistStep, quality->minViewDist);
+		return QUALITY_LOWER;
+	}
+	return QUALITY_HOLD;
+}
+
+// The view distance comes back first, it was the last to go
+static QualityDecision raise(Quality* quality)
+{
+	if (quality->viewDist < quality->maxViewDist)
+	{
+		quality->viewDist = fminf(quality->viewDist / viewDistStep, quality->maxViewDist);
+		return QUALITY_RAISE;
+	}
+	if (quality->pixelError > quality->minPixelError)
+	{
+		quality->pixelError = fmaxf(quality->pixelError / lodStep, quality->minPixelError);
+		return QUALITY_RAISE;
+	}
+	return QUALITY_HOLD;
+}
+
+bool quality_endFrame(Quality* quality, double frameMs)
+{
+	glEndQuery(GL_TIME_ELAPSED);
+	quality->frame++;
+
+	// The oldest query is a few frames old, reading it doesn't stall
+	if (quality->frame >= QUALITY_QUERIES)
+	{
+		GLuint query = quality->queries[quality->frame % QUALITY_QUERIES];
+		GLint available = 0;
+		glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+		if (available)
+		{
+			GLuint64 gpuTime = 0;
+			glGetQueryObjectui64v(query, GL_QUERY_RESULT, &gpuTime);
+			quality->gpuMs += (gpuTime / 1000000.0 - quality->gpuMs) * averageWeight;
+		}
+	}
+	quality->cpuMs += (frameMs - quality->cpuMs) * averageWeight;
+
+	if (quality->raiseWait > 0)
+		quality->raiseWait--;
+	if (quality->settle > 0)
+	{
+		quality->settle--;
+		return false;
+	}
+
+	double frame = fmax(quality->cpuMs, quality->gpuMs);
+	QualityDecision decision = QUALITY_HOLD;
+	if (frame > quality->targetMs * (1.0 + quality->band))
+		decision = lower(quality);
+	else if (frame < quality->targetMs * (1.0 - quality->band) && quality->raiseWait == 0)
+		decision = raise(quality);
+
+	if (decision == QUALITY_HOLD)
+		return false;
+
+	if (decision == QUALITY_LOWER)
+	{
+		// A raise that held for a while was fine, the load changed since
+		if (quality->decision == QUALITY_RAISE && quality->frame - quality->lastRaise <= quality->settleFrames * 2)
+		{
+			quality->raiseWait = quality->settleFrames * quality->backoff;
+			quality->backoff = min(quality->backoff * 2, 16);
+		}
+		else
+		{
+			quality->backoff = 1;
+		}
+		quality->lowered++;
+	}
+	else
+	{
+		quality->lastRaise = quality->frame;
+		quality->raised++;
+	}
+
+	quality->decision = decision;
+	quality->settle = quality->settleFrames;
+	return true;
+}
\ No newline at end of file
@@ -0,0 +1,57 @@
+#pragma once
+#include "gl_helper.h"
+
+// Holds a frame time budget by trading detail for speed
+// Frame time is the slower of the CPU's frame to frame time and the GPU
+// time of the frame. Over budget the lod bias (the world's pixelError)
+// goes up first and the view distance down second, under budget the
+// reverse. Nothing changes while the time is inside the band around the
+// target, and after a change the controller waits for the averages to settle
+#define QUALITY_QUERIES 4 // frames of GPU timings in flight
+
+typedef enum QualityDecision
+{
+	QUALITY_HOLD,
+	QUALITY_LOWER, // coarser lods or a shorter view distance
+	QUALITY_RAISE
+} QualityDecision;
+
+extern const char* qualityDecisionNames[3];
+
+typedef struct Quality
+{
+	double targetMs;
+	float band; // fraction of targetMs either way that counts as on target
+	unsigned settleFrames;
+
+	float minPixelError, maxPixelError;
+	float minViewDist, maxViewDist;
+	float pixelError; // current lod bias
+	float viewDist;
+
+	double cpuMs; // moving averages
+	double gpuMs;
+	unsigned settle; // frames left before the next decision
+	// A raise that had to be undone right away, a lower within two
+	// settleFrames of it, waits this many times settleFrames before it's
+	// tried again, doubling each time
+	unsigned backoff;
+	unsigned raiseWait;
+	unsigned lastRaise; // frame of the last raise
+
+	GLuint queries[QUALITY_QUERIES];
+	unsigned frame;
+
+	QualityDecision decision; // last one that changed anything
+	size_t lowered, raised;
+} Quality;
+
+// Starts at the best quality within the bounds
+bool quality_create(Quality* quality, double targetMs, float minPixelError, float maxPixelError,
+	float minViewDist, float maxViewDist);
+void quality_destroy(Quality* quality);
+
+// Around everything drawn in a frame, frameMs is the time since the last
+// frame started. Returns true when pixelError or viewDist changed
+void quality_beginFrame(Quality* quality);
+bool quality_endFrame(Quality* quality, double frameMs);
\ No newline at end of file
@@ -1,9 +1,17 @@
 #version 330 core
 
 in vec4 outColor;
+in vec2 worldXZ;
 out vec4 pixelColor;
 
+uniform vec3 camPos;
+// Nothing closer than this along the ground is drawn, 0 draws everything
+uniform float clipDist;
+
 void main()
 {
+	if (length(worldXZ - camPos.xz) < clipDist)
+		discard;
+
 	pixelColor = outColor;
 }
\ No newline at end of file
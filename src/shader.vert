@@ -1,31 +1,91 @@
 #version 330 core
 
-layout (location = 0) in vec3 inPos;
-layout (location = 1) in vec3 inColor;
+layout (location = 0) in float inHeight;
+layout (location = 1) in vec2 inNormal;
+layout (location = 2) in float inMorphHeight;
 
 out vec4 outColor;
+out vec2 worldXZ;
 
 uniform mat4 projMat;
 uniform mat4 viewMat;
 uniform vec3 camPos;
 uniform float viewDist;
+uniform float seaLevel;
+
+uniform vec3 modelOrigin;
+uniform vec3 modelScale;
+uniform int gridSize;
+uniform bool soup;
+
+// CDLOD nodes morph onto their parent's grid between these distances,
+// morphEnd 0 turns it off
+uniform float morphStart;
+uniform float morphEnd;
+
+// Corner order of the six soup samples per cell, matches gridIndices
+const ivec2 soupCorners[6] = ivec2[6](
+	ivec2(0, 1), ivec2(1, 1), ivec2(0, 0),
+	ivec2(0, 0), ivec2(1, 1), ivec2(1, 0));
+
+uniform vec3 lightDir;
+uniform float ambient;
+
+uniform sampler1D gradient;
+uniform float gradientMin;
+uniform float gradientMax;
+
+// Inverse of octEncode in vectorMath.h
+vec3 octDecode(vec2 e)
+{
+	vec3 n = vec3(e.x, 1.0 - abs(e.x) - abs(e.y), e.y);
+	if (n.y < 0.0)
+		n.xz = (1.0 - abs(n.zx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.z >= 0.0 ? 1.0 : -1.0);
+	return normalize(n);
+}
 
 void main()
 {
-	gl_Position = projMat * viewMat * vec4(inPos - camPos, 1.0);
+	// Vertices are stored row by row, so the grid position is implied by the index
+	ivec2 grid = ivec2(gl_VertexID % gridSize, gl_VertexID / gridSize);
+	if (soup)
+	{
+		int quad = gl_VertexID / 6;
+		grid = ivec2(quad % (gridSize - 1), quad / (gridSize - 1)) + soupCorners[gl_VertexID % 6];
+	}
+	vec2 cell = vec2(grid) / float(gridSize - 1);
+	vec3 pos = modelOrigin + vec3(cell.x, inHeight, cell.y) * modelScale;
+
+	float height = inHeight;
+	if (morphEnd > 0.0)
+	{
+		float morph = clamp((length(pos.xz - camPos.xz) - morphStart) / (morphEnd - morphStart), 0.0, 1.0);
+
+		// Odd vertices slide onto the even vertex below them
+		vec2 morphed = vec2(grid) - fract(vec2(grid) * 0.5) * 2.0 * morph;
+		height = mix(inHeight, inMorphHeight, morph);
+
+		cell = morphed / float(gridSize - 1);
+		pos = modelOrigin + vec3(cell.x, height, cell.y) * modelScale;
+	}
+
+	gl_Position = projMat * viewMat * vec4(pos - camPos, 1.0);
+	worldXZ = pos.xz;
 
-	float camDist = length(inPos.xz - camPos.xz);
+	float camDist = length(pos.xz - camPos.xz);
 
-	vec3 color = inColor;
+	float diffuse = max(dot(octDecode(inNormal), normalize(lightDir)), 0.0);
+	vec3 terrainColor = texture(gradient, (height - gradientMin) / (gradientMax - gradientMin)).rgb;
+	terrainColor *= ambient + (1.0 - ambient) * diffuse;
+	vec3 color = terrainColor;
 
-	float seaLevel = 125.0;
 	if (camPos.y < seaLevel)
 	{
 		float depthEffect = clamp((1.0 - (camPos.y / seaLevel)) * 0.8 + 0.2, 0.0, 1.0);
 		vec3 waterColor = vec3(0.0, 0.0, 0.4);
-		color.r = mix(waterColor.r, inColor.r, depthEffect);
-		color.g = mix(waterColor.g, inColor.g, depthEffect);
-		color.b = mix(waterColor.b, inColor.b, depthEffect);
+		color.r = mix(waterColor.r, terrainColor.r, depthEffect);
+		color.g = mix(waterColor.g, terrainColor.g, depthEffect);
+		color.b = mix(waterColor.b, terrainColor.b, depthEffect);
 	}
 
 	float a = 1.0;
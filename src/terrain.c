@@ -0,0 +1,559 @@
+#include "terrain.h"
+
+#include "perlin.h"
+#include "meshOpt.h"
+#include "thread.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#define TERRAIN_SSE2
+#include <emmintrin.h>
+#endif
+
+const char* meshModeNames[MESH_MODE_COUNT] = { "Soup", "Grid", "Strip", "Adaptive" };
+
+const float seaLevel = 124.75f;
+const float seaFloorDetail = 2.f;
+
+const float chunkSize = 1000.f;
+const float chunkScale = 0.01f;
+
+
+float noiseMod(float height)
+{
+	return height * 250.f;
+}
+
+float noise(float x, float z)
+{
+	float perlin = Perlin_Get2d(x, z, 0.0001f, 5);
+	float pow = powf(perlin * 2.f - 1.f, 3.f) / 2.f + 0.5f;
+	if (perlin <= 0.5f)
+		return lerp(pow, perlin, 0.75f);
+	else
+		return pow;
+}
+
+
+void noiseRow(float* out, float x, float dx, float z, unsigned count)
+{
+	Perlin_Get2dRow(out, x, dx, z, (int)count, 0.0001f, 5);
+
+	unsigned i = 0;
+
+#ifdef TERRAIN_SSE2
+	const __m128 half = _mm_set1_ps(0.5f);
+	const __m128 mix = _mm_set1_ps(0.75f);
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128 perlin = _mm_loadu_ps(out + i);
+
+		__m128 centered = _mm_sub_ps(_mm_add_ps(perlin, perlin), _mm_set1_ps(1.f));
+		__m128 pow = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(_mm_mul_ps(centered, centered), centered), half), half);
+		__m128 low = _mm_add_ps(_mm_mul_ps(pow, mix), _mm_mul_ps(perlin, _mm_sub_ps(_mm_set1_ps(1.f), mix)));
+
+		// Same as the branch in noise, without the branch
+		__m128 isLow = _mm_cmple_ps(perlin, half);
+		_mm_storeu_ps(out + i, _mm_or_ps(_mm_and_ps(isLow, low), _mm_andnot_ps(isLow, pow)));
+	}
+#endif
+
+	for (; i < count; i++)
+	{
+		float perlin = out[i];
+		float pow = powf(perlin * 2.f - 1.f, 3.f) / 2.f + 0.5f;
+		out[i] = perlin <= 0.5f ? lerp(pow, perlin, 0.75f) : pow;
+	}
+}
+
+float quantizeHeights(uint16_t* out, const float* heights, size_t count)
+{
+	float maxHeight = 0.f;
+	size_t i = 0;
+
+#ifdef TERRAIN_SSE2
+	const __m128 scale = _mm_set1_ps(65535.f);
+	const __m128 half = _mm_set1_ps(0.5f);
+	const __m128i bias = _mm_set1_epi32(32768);
+	__m128 maxHeights = _mm_setzero_ps();
+	for (; i + 8 <= count; i += 8)
+	{
+		__m128 h0 = _mm_loadu_ps(heights + i);
+		__m128 h1 = _mm_loadu_ps(heights + i + 4);
+		maxHeights = _mm_max_ps(maxHeights, _mm_max_ps(h0, h1));
+
+		h0 = _mm_min_ps(_mm_max_ps(h0, _mm_setzero_ps()), _mm_set1_ps(1.f));
+		h1 = _mm_min_ps(_mm_max_ps(h1, _mm_setzero_ps()), _mm_set1_ps(1.f));
+		__m128i q0 = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(h0, scale), half));
+		__m128i q1 = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(h1, scale), half));
+
+		// SSE2 only packs signed, so shift into int16 range and flip the sign bit back
+		__m128i packed = _mm_packs_epi32(_mm_sub_epi32(q0, bias), _mm_sub_epi32(q1, bias));
+		_mm_storeu_si128((__m128i*)(out + i), _mm_xor_si128(packed, _mm_set1_epi16((short)0x8000)));
+	}
+
+	float lanes[4];
+	_mm_storeu_ps(lanes, maxHeights);
+	maxHeight = fmaxf(fmaxf(lanes[0], lanes[1]), fmaxf(lanes[2], lanes[3]));
+#endif
+
+	for (; i < count; i++)
+	{
+		out[i] = toUnorm16(heights[i]);
+		maxHeight = fmaxf(maxHeight, heights[i]);
+	}
+
+	return maxHeight;
+}
+
+
+// 0.2 is min ocean
+// 0.4 is avg min ocean
+// 0.5 is max ocean
+RGB colorFromHeight(float height)
+{
+	RGB color = { 0 };
+
+	const RGB deepColor = {0.f, 0.f, 0.05f};
+	const RGB waterColor = {0.f, 0.f, 0.25f};
+	const RGB sandColor = {0.5f, 0.5f, 0.35f};
+	const RGB grassColor = {0.35f, 0.5f, 0.15f};
+	const RGB coldColor = {0.f, 0.25f, 0.15f};
+	const RGB stoneColor = {0.25f, 0.25f, 0.25f};
+	const RGB snowColor = {0.7f, 0.7f, 0.8f};
+
+	const float deepHeight = 0.45f;
+	const float waterHeight = 0.499f;
+	const float sandHeight = 0.50f;
+	const float grassHeight = 0.501;
+	const float coldHeight = 0.52f;
+	const float stoneHeight = 0.58f;
+	const float snowHeight = 0.64f;
+
+	if (height <= waterHeight)
+	{
+		float value = (height - deepHeight) / (waterHeight - deepHeight);
+		color = lerpRGB(waterColor, deepColor, value);
+	}
+	else if (height <= sandHeight)
+	{
+		float value = (height - waterHeight) / (sandHeight - waterHeight);
+		color = lerpRGB(sandColor, waterColor, value);
+	}
+	else if (height <= grassHeight)
+	{
+		float value = (height - sandHeight) / (grassHeight - sandHeight);
+		color = lerpRGB(grassColor, sandColor, value);
+	}
+	else if (height <= coldHeight)
+	{
+		float value = (height - grassHeight) / (coldHeight - grassHeight);
+		color = lerpRGB(coldColor, grassColor, value);
+	}
+	else if (height <= stoneHeight)
+	{
+		float value = (height - coldHeight) / (stoneHeight - coldHeight);
+		color = lerpRGB(stoneColor, coldColor, value);
+	}
+	else if (height <= snowHeight)
+	{
+		float value = (height - stoneHeight) / (snowHeight - stoneHeight);
+		color = lerpRGB(snowColor, stoneColor, value);
+	}
+	else
+	{
+		color = snowColor;
+	}
+
+	return color;
+}
+
+
+unsigned lodCells(int lod)
+{
+	lod = max(min(lod, 8), 1);
+
+	// Nearest power of two to the old 5 * 1.75^lod step,
+	// RTIN needs a 2^n + 1 grid
+	float step = 5.f * powf(1.75f, lod);
+	return 1u << (unsigned)roundf(log2f(chunkSize * 2.f / step));
+}
+
+void gridIndices(uint32_t* indices, unsigned cells)
+{
+	unsigned gridSize = cells + 1;
+
+	size_t pos = 0;
+	for (unsigned z = 0; z < cells; z++)
+		for (unsigned x = 0; x < cells; x++)
+		{
+			uint32_t i00 = x + z * gridSize;
+			uint32_t i10 = i00 + 1;
+			uint32_t i01 = i00 + gridSize;
+			uint32_t i11 = i01 + 1;
+
+			indices[pos + 0] = i01;
+			indices[pos + 1] = i11;
+			indices[pos + 2] = i00;
+
+			indices[pos + 3] = i00;
+			indices[pos + 4] = i11;
+			indices[pos + 5] = i10;
+
+			pos += 6;
+		}
+}
+
+
+size_t stripIndices(uint32_t* indices, unsigned cells)
+{
+	unsigned gridSize = cells + 1;
+
+	size_t pos = 0;
+	for (unsigned z = 0; z < cells; z++)
+	{
+		if (z > 0)
+			indices[pos++] = RESTART_INDEX;
+
+		// Near row first keeps the strip counter-clockwise
+		for (unsigned x = 0; x < gridSize; x++)
+		{
+			indices[pos++] = x + z * gridSize;
+			indices[pos++] = x + (z + 1) * gridSize;
+		}
+	}
+
+	return pos;
+}
+
+// Corner order of the six soup samples per cell, same as gridIndices
+static const unsigned soupCorners[6][2] = { { 0, 1 }, { 1, 1 }, { 0, 0 }, { 0, 0 }, { 1, 1 }, { 1, 0 } };
+
+// Expands the grid into six samples per cell
+static void soupHeights(uint16_t* soup, const uint16_t* heights, unsigned cells)
+{
+	unsigned gridSize = cells + 1;
+
+	size_t pos = 0;
+	for (unsigned z = 0; z < cells; z++)
+		for (unsigned x = 0; x < cells; x++)
+			for (int k = 0; k < 6; k++)
+				soup[pos++] = heights[(x + soupCorners[k][0]) + (z + soupCorners[k][1]) * gridSize];
+}
+
+static void soupNormals(uint32_t* soup, const uint32_t* normals, unsigned cells)
+{
+	unsigned gridSize = cells + 1;
+
+	size_t pos = 0;
+	for (unsigned z = 0; z < cells; z++)
+		for (unsigned x = 0; x < cells; x++)
+			for (int k = 0; k < 6; k++)
+				soup[pos++] = normals[(x + soupCorners[k][0]) + (z + soupCorners[k][1]) * gridSize];
+}
+
+void gridNormals(uint32_t* normals, const float* border, unsigned gridSize, float spacing)
+{
+	unsigned stride = gridSize + 2;
+	for (unsigned z = 0; z < gridSize; z++)
+	{
+		const float* h = border + (z + 1) * stride + 1;
+		for (unsigned x = 0; x < gridSize; x++, h++)
+		{
+			float dx = noiseMod(h[-1] - h[1]);
+			float dz = noiseMod(*(h - stride) - *(h + stride));
+			normals[x + z * gridSize] = octEncode(normalize(vec3f(dx, spacing * 2.f, dz)));
+		}
+	}
+}
+
+// Right-angled irregular network, after Evans et al. and mapbox/martini
+// Triangles are split along their hypotenuse, and a split is only kept if
+// the height error at the hypotenuse midpoint (or in any child) exceeds maxError
+static void rtinErrors(float* errors, const float* heights, unsigned cells)
+{
+	unsigned gridSize = cells + 1;
+	size_t numTriangles = (size_t)cells * cells * 2 - 2;
+	size_t numParentTriangles = numTriangles - (size_t)cells * cells;
+
+	memset(errors, 0, sizeof(float) * gridSize * gridSize);
+
+	// Walk from the smallest triangles up, so children are done before parents
+	for (size_t i = numTriangles; i-- > 0;)
+	{
+		size_t id = i + 2;
+		unsigned ax = 0, ay = 0, bx = 0, by = 0, cx = 0, cy = 0;
+		if (id & 1)
+		{
+			bx = by = cx = cells;
+		}
+		else
+		{
+			ax = ay = cy = cells;
+		}
+
+		while ((id >>= 1) > 1)
+		{
+			unsigned mx = (ax + bx) >> 1;
+			unsigned my = (ay + by) >> 1;
+
+			if (id & 1)
+			{
+				bx = ax;
+				by = ay;
+				ax = cx;
+				ay = cy;
+			}
+			else
+			{
+				ax = bx;
+				ay = by;
+				bx = cx;
+				by = cy;
+			}
+			cx = mx;
+			cy = my;
+		}
+
+		unsigned mx = (ax + bx) >> 1;
+		unsigned my = (ay + by) >> 1;
+		size_t middle = mx + my * gridSize;
+
+		float interpolated = (heights[ax + ay * gridSize] + heights[bx + by * gridSize]) / 2.f;
+		float error = fmaxf(errors[middle], fabsf(interpolated - heights[middle]));
+
+		if (i < numParentTriangles)
+		{
+			cx = mx + my - ay;
+			cy = my + ax - mx;
+			error = fmaxf(error, errors[((ax + cx) >> 1) + ((ay + cy) >> 1) * gridSize]);
+			error = fmaxf(error, errors[((bx + cx) >> 1) + ((by + cy) >> 1) * gridSize]);
+		}
+
+		errors[middle] = error;
+	}
+}
+
+static size_t rtinTriangle(uint32_t* indices, size_t pos, const float* errors, unsigned gridSize,
+	float maxError, unsigned ax, unsigned ay, unsigned bx, unsigned by, unsigned cx, unsigned cy)
+{
+	unsigned mx = (ax + bx) >> 1;
+	unsigned my = (ay + by) >> 1;
+
+	if (abs((int)ax - (int)cx) + abs((int)ay - (int)cy) > 1 && errors[mx + my * gridSize] > maxError)
+	{
+		pos = rtinTriangle(indices, pos, errors, gridSize, maxError, cx, cy, ax, ay, mx, my);
+		pos = rtinTriangle(indices, pos, errors, gridSize, maxError, bx, by, cx, cy, mx, my);
+	}
+	else
+	{
+		indices[pos + 0] = ax + ay * gridSize;
+		indices[pos + 1] = bx + by * gridSize;
+		indices[pos + 2] = cx + cy * gridSize;
+		pos += 3;
+	}
+
+	return pos;
+}
+
+static size_t rtinIndices(uint32_t* indices, const float* errors, unsigned cells, float maxError)
+{
+	size_t pos = 0;
+	pos = rtinTriangle(indices, pos, errors, cells + 1, maxError, 0, 0, cells, cells, cells, 0);
+	pos = rtinTriangle(indices, pos, errors, cells + 1, maxError, cells, cells, 0, 0, 0, cells);
+	return pos;
+}
+
+// Interpolates the fine grid from every coarser power of two grid, split
+// along the same diagonal as gridIndices, and keeps the largest difference
+static void gridErrors(float* lodError, const float* heights, unsigned cells)
+{
+	unsigned gridSize = cells + 1;
+	unsigned level = 0;
+	while ((1u << level) < cells)
+		level++;
+
+	for (unsigned coarse = 0; coarse < level; coarse++)
+	{
+		unsigned step = cells >> coarse;
+		float maxError = 0.f;
+		for (unsigned z = 0; z < cells; z++)
+		{
+			unsigned z0 = z / step * step;
+			float fz = (float)(z - z0) / step;
+			const float* row0 = heights + z0 * gridSize;
+			const float* row1 = row0 + step * gridSize;
+			for (unsigned x = 0; x < cells; x++)
+			{
+				unsigned x0 = x / step * step;
+				float fx = (float)(x - x0) / step;
+				float h00 = row0[x0], h10 = row0[x0 + step];
+				float h01 = row1[x0], h11 = row1[x0 + step];
+
+				float h = fx >= fz ?
+					h00 + fx * (h10 - h00) + fz * (h11 - h10) :
+					h00 + fz * (h01 - h00) + fx * (h11 - h01);
+				maxError = fmaxf(maxError, fabsf(heights[x + z * gridSize] - h));
+			}
+		}
+		lodError[coarse] = maxError;
+	}
+
+	// Finer grids than the one sampled are guessed to halve the error per
+	// step, roughly what the noise's octaves do
+	for (; level < MESH_ERROR_LEVELS; level++)
+		lodError[level] = level ? lodError[level - 1] * 0.5f : 0.f;
+}
+
+static bool cancelled(volatile long* cancel)
+{
+	return cancel && thr_atomicLoad(cancel);
+}
+
+// Centre and half width in noise units
+static bool buildGridMesh(Mesh* mesh, Arena* scratch, float xx, float zz, float size, unsigned cells, MeshMode mode, float maxError,
+	volatile long* cancel)
+{
+	memset(mesh, 0, sizeof(Mesh));
+	arena_reset(scratch);
+
+	float scale = chunkScale;
+	float spacing = size * 2.f / cells;
+
+	size_t gridSize = cells + 1;
+	size_t gridVerts = gridSize * gridSize;
+
+	mesh->gridSize = (unsigned)gridSize;
+	mesh->vertCount = gridVerts;
+	mesh->primitive = GL_TRIANGLES;
+	mesh->triangles = (size_t)cells * cells * 2;
+	mesh->origin = vec3f(scale * (xx - size), 0.f, scale * (zz - size));
+	mesh->scale = vec3f(scale * size * 2.f, noiseMod(1.f), scale * size * 2.f);
+
+	// One extra sample on every side for the normals
+	size_t borderSize = gridSize + 2;
+	float* border = arena_alloc(scratch, sizeof(float) * borderSize * borderSize);
+	float* heights = arena_alloc(scratch, sizeof(float) * gridVerts);
+	if (!border || !heights)
+		return false;
+
+	// Rows of floats first, then one wide pass packs them into the vertex stream
+	for (unsigned gz = 0; gz < borderSize; gz++)
+	{
+		if (cancelled(cancel))
+			return false;
+		noiseRow(border + gz * borderSize, xx - size - spacing, spacing, zz - size + (gz - 1.f) * spacing, (unsigned)borderSize);
+	}
+
+	for (unsigned gz = 0; gz < gridSize; gz++)
+		memcpy(heights + gz * gridSize, border + (gz + 1) * borderSize + 1, sizeof(float) * gridSize);
+
+	// Errors are measured in world units, deep seafloor is flattened for
+	// them since the water plane hides it anyway
+	float* errorHeights = arena_alloc(scratch, sizeof(float) * gridVerts);
+	if (!errorHeights)
+		return false;
+	for (size_t i = 0; i < gridVerts; i++)
+		errorHeights[i] = fmaxf(noiseMod(heights[i]), seaLevel - seaFloorDetail);
+
+	gridErrors(mesh->lodError, errorHeights, cells);
+
+	// Every size is known in closed form except RTIN's, which is built in
+	// scratch first so the mesh block can be allocated exactly
+	uint32_t* adaptiveIndices = NULL;
+	if (mode == MESH_ADAPTIVE)
+	{
+		// The vertices keep their seafloor height, but with the flattened
+		// error heights whole basins collapse into a few triangles
+		float* errors = arena_alloc(scratch, sizeof(float) * gridVerts);
+		adaptiveIndices = arena_alloc(scratch, sizeof(uint32_t) * cells * cells * 6);
+		if (!errors || !adaptiveIndices)
+			return false;
+
+		rtinErrors(errors, errorHeights, cells);
+		mesh->indexCount = rtinIndices(adaptiveIndices, errors, cells, maxError);
+		mesh->triangles = mesh->indexCount / 3;
+		if (cancelled(cancel))
+			return false;
+	}
+	else if (mode == MESH_STRIP)
+	{
+		// Two indices per vertex per row, plus a restart between rows
+		mesh->primitive = GL_TRIANGLE_STRIP;
+		mesh->indexCount = (size_t)cells * gridSize * 2 + cells - 1;
+	}
+	else if (mode == MESH_SOUP)
+	{
+		mesh->vertCount = (size_t)cells * cells * 6;
+		mesh->indexCount = 0;
+	}
+	else
+	{
+		mesh->indexCount = (size_t)cells * cells * 6;
+	}
+
+	// Heights, normals and indices share one pooled block, recycled by freeMesh
+	size_t heightBytes = (mesh->vertCount * sizeof(uint16_t) + 3) & ~(size_t)3;
+	size_t normalBytes = mesh->vertCount * sizeof(uint32_t);
+	mesh->blockSize = heightBytes + normalBytes + mesh->indexCount * sizeof(uint32_t);
+	mesh->block = pool_alloc(mesh->blockSize);
+	if (!mesh->block)
+		return false;
+
+	mesh->heights = mesh->block;
+	mesh->normals = (uint32_t*)((uint8_t*)mesh->block + heightBytes);
+	mesh->indices = mesh->indexCount ? (uint32_t*)((uint8_t*)mesh->block + heightBytes + normalBytes) : NULL;
+
+	if (mode == MESH_SOUP)
+	{
+		uint16_t* gridHeights = arena_alloc(scratch, sizeof(uint16_t) * gridVerts);
+		uint32_t* normals = arena_alloc(scratch, sizeof(uint32_t) * gridVerts);
+		if (!gridHeights || !normals)
+		{
+			freeMesh(mesh);
+			return false;
+		}
+
+		mesh->maxHeight = noiseMod(quantizeHeights(gridHeights, heights, gridVerts));
+		gridNormals(normals, border, (unsigned)gridSize, spacing * scale);
+		soupHeights(mesh->heights, gridHeights, cells);
+		soupNormals(mesh->normals, normals, cells);
+	}
+	else
+	{
+		mesh->maxHeight = noiseMod(quantizeHeights(mesh->heights, heights, gridVerts));
+		gridNormals(mesh->normals, border, (unsigned)gridSize, spacing * scale);
+	}
+
+	if (mode == MESH_ADAPTIVE)
+		memcpy(mesh->indices, adaptiveIndices, sizeof(uint32_t) * mesh->indexCount);
+	else if (mode == MESH_STRIP)
+		stripIndices(mesh->indices, cells);
+	else if (mode == MESH_GRID)
+		gridIndices(mesh->indices, cells);
+
+	optimizeMesh(mesh, scratch);
+
+	return true;
+}
+
+bool buildChunkMesh(Mesh* mesh, Arena* scratch, float x, float z, int lod, MeshMode mode, float maxError, volatile long* cancel)
+{
+	// Uniform spacing, so neighbours at the same lod share their edge samples
+	return buildGridMesh(mesh, scratch, x * chunkSize * 2.f, z * chunkSize * 2.f, chunkSize, lodCells(lod), mode, maxError, cancel);
+}
+
+bool buildAreaMesh(Mesh* mesh, Arena* scratch, float x, float z, float halfSize, unsigned cells, MeshMode mode, float maxError)
+{
+	return buildGridMesh(mesh, scratch, x / chunkScale, z / chunkScale, halfSize / chunkScale, cells, mode, maxError, NULL);
+}
+
+void freeMesh(Mesh* mesh)
+{
+	if (!mesh->mapped)
+		pool_free(mesh->block, mesh->blockSize);
+	mesh->block = NULL;
+	mesh->mapped = false;
+	mesh->heights = NULL;
+	mesh->normals = NULL;
+	mesh->indices = NULL;
+}
\ No newline at end of file
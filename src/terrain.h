@@ -0,0 +1,57 @@
+#pragma once
+#include "gl_helper.h"
+#include "arena.h"
+
+typedef enum MeshMode
+{
+	MESH_SOUP,     // unindexed, six samples per grid cell like the original chunks
+	MESH_GRID,     // every grid cell as two indexed triangles
+	MESH_STRIP,    // one triangle strip per grid row, joined by primitive restart
+	MESH_ADAPTIVE, // RTIN, triangles only where the height error is above maxError
+	MESH_MODE_COUNT
+} MeshMode;
+
+extern const char* meshModeNames[MESH_MODE_COUNT];
+
+// Water surface height in world units, drawn as its own flat plane
+extern const float seaLevel;
+// Seafloor deeper than this below seaLevel is hidden by the water plane,
+// so adaptive meshing merges it into large triangles
+extern const float seaFloorDetail;
+
+// Half width of a chunk in noise units, and noise units to render units
+extern const float chunkSize;
+extern const float chunkScale;
+
+float noiseMod(float height);
+float noise(float x, float z);
+// noise for count samples along x, dx apart
+void noiseRow(float* out, float x, float dx, float z, unsigned count);
+
+// Writes unorm16 heights, returns the largest input height
+float quantizeHeights(uint16_t* out, const float* heights, size_t count);
+
+RGB colorFromHeight(float height);
+
+// Octahedral normals by central differences over a noise grid with a one
+// sample border, so edge normals match the neighbouring grid.
+// spacing is in render units
+void gridNormals(uint32_t* normals, const float* border, unsigned gridSize, float spacing);
+
+// Grid cells per chunk side for a lod, always a power of two
+unsigned lodCells(int lod);
+
+void gridIndices(uint32_t* indices, unsigned cells);
+// Returns the index count, rows are separated by RESTART_INDEX
+size_t stripIndices(uint32_t* indices, unsigned cells);
+
+// Builds the CPU side mesh for chunk (x, z), temporaries come from scratch
+// which is reset first, the mesh itself is a pooled block
+// maxError is in world units and only used by MESH_ADAPTIVE. The build
+// gives up and returns false once cancel, when not NULL, is set
+bool buildChunkMesh(Mesh* mesh, Arena* scratch, float x, float z, int lod, MeshMode mode, float maxError, volatile long* cancel);
+// Same for any square, x and z are its centre and halfSize its half width,
+// all in render units. cells has to be a power of two for MESH_ADAPTIVE
+bool buildAreaMesh(Mesh* mesh, Arena* scratch, float x, float z, float halfSize, unsigned cells, MeshMode mode, float maxError);
+
+void freeMesh(Mesh* mesh);
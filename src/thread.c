@@ -0,0 +1,288 @@
+#ifndef _WIN32
+// clock_gettime under strict C
+#define _POSIX_C_SOURCE 200809L
+#endif
+#include "thread.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <process.h>
+#else
+#include <unistd.h>
+#include <sched.h>
+#include <time.h>
+#endif
+
+typedef struct ThreadStart
+{
+	ThreadFunc func;
+	void* data;
+} ThreadStart;
+
+#ifdef _WIN32
+static unsigned __stdcall threadStart(void* arg)
+{
+	ThreadStart start = *(ThreadStart*)arg;
+	free(arg);
+	return (unsigned)start.func(start.data);
+}
+#else
+static void* threadStart(void* arg)
+{
+	ThreadStart start = *(ThreadStart*)arg;
+	free(arg);
+	start.func(start.data);
+	return NULL;
+}
+#endif
+
+bool thr_create(Thread* thread, ThreadFunc func, void* data)
+{
+	ThreadStart* start = malloc(sizeof(ThreadStart));
+	if (!start)
+		return false;
+	start->func = func;
+	start->data = data;
+
+#ifdef _WIN32
+	thread->handle = (void*)_beginthreadex(NULL, 0, threadStart, start, 0, NULL);
+	if (!thread->handle)
+	{
+		free(start);
+		return false;
+	}
+#else
+	if (pthread_create(&thread->handle, NULL, threadStart, start) != 0)
+	{
+		free(start);
+		return false;
+	}
+#endif
+
+	return true;
+}
+
+void thr_join(Thread thread)
+{
+#ifdef _WIN32
+	WaitForSingleObject(thread.handle, INFINITE);
+	CloseHandle(thread.handle);
+#else
+	pthread_join(thread.handle, NULL);
+#endif
+}
+
+unsigned thr_cpuCount()
+{
+#ifdef _WIN32
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return info.dwNumberOfProcessors > 0 ? info.dwNumberOfProcessors : 1;
+#else
+	long count = sysconf(_SC_NPROCESSORS_ONLN);
+	return count > 0 ? (unsigned)count : 1;
+#endif
+}
+
+void thr_yield()
+{
+#ifdef _WIN32
+	SwitchToThread();
+#else
+	sched_yield();
+#endif
+}
+
+double thr_time()
+{
+#ifdef _WIN32
+	LARGE_INTEGER frequency, counter;
+	QueryPerformanceFrequency(&frequency);
+	QueryPerformanceCounter(&counter);
+	return (double)counter.QuadPart / (double)frequency.QuadPart;
+#else
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (double)now.tv_sec + (double)now.tv_nsec * 1e-9;
+#endif
+}
+
+void thr_mutexLock(Mutex* mutex)
+{
+#ifdef _WIN32
+	AcquireSRWLockExclusive((PSRWLOCK)&mutex->lock);
+#else
+	pthread_mutex_lock(&mutex->lock);
+#endif
+}
+
+void thr_mutexUnlock(Mutex* mutex)
+{
+#ifdef _WIN32
+	ReleaseSRWLockExclusive((PSRWLOCK)&mutex->lock);
+#else
+	pthread_mutex_unlock(&mutex->lock);
+#endif
+}
+
+void thr_condWait(Cond* cond, Mutex* mutex)
+{
+#ifdef _WIN32
+	SleepConditionVariableSRW((PCONDITION_VARIABLE)&cond->cond, (PSRWLOCK)&mutex->lock, INFINITE, 0);
+#else
+	pthread_cond_wait(&cond->cond, &mutex->lock);
+#endif
+}
+
+void thr_condSignal(Cond* cond)
+{
+#ifdef _WIN32
+	WakeConditionVariable((PCONDITION_VARIABLE)&cond->cond);
+#else
+	pthread_cond_signal(&cond->cond);
+#endif
+}
+
+void thr_condBroadcast(Cond* cond)
+{
+#ifdef _WIN32
+	WakeAllConditionVariable((PCONDITION_VARIABLE)&cond->cond);
+#else
+	pthread_cond_broadcast(&cond->cond);
+#endif
+}
+
+long thr_atomicAdd(volatile long* value, long amount)
+{
+#ifdef _WIN32
+	return InterlockedExchangeAdd(value, amount) + amount;
+#else
+	return __atomic_add_fetch(value, amount, __ATOMIC_SEQ_CST);
+#endif
+}
+
+long thr_atomicLoad(volatile long* value)
+{
+#ifdef _WIN32
+	return InterlockedCompareExchange(value, 0, 0);
+#else
+	return __atomic_load_n(value, __ATOMIC_SEQ_CST);
+#endif
+}
+
+void thr_atomicStore(volatile long* value, long newValue)
+{
+#ifdef _WIN32
+	InterlockedExchange(value, newValue);
+#else
+	__atomic_store_n(value, newValue, __ATOMIC_SEQ_CST);
+#endif
+}
+
+bool thr_atomicCas(volatile long* value, long expected, long desired)
+{
+#ifdef _WIN32
+	return InterlockedCompareExchange(value, desired, expected) == expected;
+#else
+	return __atomic_compare_exchange_n(value, &expected, desired, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+#endif
+}
+
+
+// Positions only ever grow, differences are taken unsigned so they stay
+// right when a position wraps
+static long seqDiff(long a, long b)
+{
+	return (long)((unsigned long)a - (unsigned long)b);
+}
+
+static volatile long* cellSeq(Queue* queue, long pos)
+{
+	return (volatile long*)(queue->cells + (size_t)(pos & queue->mask) * queue->cellSize);
+}
+
+bool thr_queueCreate(Queue* queue, size_t capacity, size_t itemSize)
+{
+	memset(queue, 0, sizeof(Queue));
+
+	size_t size = 2;
+	while (size < capacity)
+		size *= 2;
+
+	// Sequence number first and the item after it, items are only ever
+	// copied so only the sequence number needs to stay aligned
+	queue->itemSize = itemSize;
+	queue->cellSize = (sizeof(long) + itemSize + 7) & ~(size_t)7;
+	queue->mask = (long)size - 1;
+	queue->cells = malloc(queue->cellSize * size);
+	if (!queue->cells)
+		return false;
+
+	for (long i = 0; i < (long)size; i++)
+		*cellSeq(queue, i) = i;
+	return true;
+}
+
+void thr_queueDestroy(Queue* queue)
+{
+	free(queue->cells);
+	memset(queue, 0, sizeof(Queue));
+}
+
+bool thr_queuePush(Queue* queue, const void* item)
+{
+	long pos = thr_atomicLoad(&queue->pushPos);
+	while (true)
+	{
+		long diff = seqDiff(thr_atomicLoad(cellSeq(queue, pos)), pos);
+		if (diff == 0)
+		{
+			if (thr_atomicCas(&queue->pushPos, pos, pos + 1))
+				break;
+			pos = thr_atomicLoad(&queue->pushPos);
+		}
+		else if (diff < 0)
+			return false; // the cell still holds an item from a lap ago
+		else
+			pos = thr_atomicLoad(&queue->pushPos);
+	}
+
+	volatile long* seq = cellSeq(queue, pos);
+	memcpy((unsigned char*)seq + sizeof(long), item, queue->itemSize);
+	thr_atomicStore(seq, pos + 1);
+	return true;
+}
+
+bool thr_queuePop(Queue* queue, void* item)
+{
+	long pos = thr_atomicLoad(&queue->popPos);
+	while (true)
+	{
+		long diff = seqDiff(thr_atomicLoad(cellSeq(queue, pos)), pos + 1);
+		if (diff == 0)
+		{
+			if (thr_atomicCas(&queue->popPos, pos, pos + 1))
+				break;
+			pos = thr_atomicLoad(&queue->popPos);
+		}
+		else if (diff < 0)
+			return false; // nothing pushed here yet
+		else
+			pos = thr_atomicLoad(&queue->popPos);
+	}
+
+	volatile long* seq = cellSeq(queue, pos);
+	memcpy(item, (unsigned char*)seq + sizeof(long), queue->itemSize);
+	thr_atomicStore(seq, pos + queue->mask + 1);
+	return true;
+}
+
+size_t thr_queueCount(Queue* queue)
+{
+	return (size_t)seqDiff(thr_atomicLoad(&queue->pushPos), thr_atomicLoad(&queue->popPos));
+}
\ No newline at end of file
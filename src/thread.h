@@ -0,0 +1,99 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+
+// Small portable layer over Win32 and pthreads
+
+#ifdef _WIN32
+typedef struct Thread
+{
+	void* handle;
+} Thread;
+
+// SRWLOCK, all zero is unlocked
+typedef struct Mutex
+{
+	void* lock;
+} Mutex;
+#define MUTEX_INIT { 0 }
+
+// CONDITION_VARIABLE, all zero is ready to use
+typedef struct Cond
+{
+	void* cond;
+} Cond;
+#define COND_INIT { 0 }
+#else
+#include <pthread.h>
+typedef struct Thread
+{
+	pthread_t handle;
+} Thread;
+
+typedef struct Mutex
+{
+	pthread_mutex_t lock;
+} Mutex;
+#define MUTEX_INIT { PTHREAD_MUTEX_INITIALIZER }
+
+typedef struct Cond
+{
+	pthread_cond_t cond;
+} Cond;
+#define COND_INIT { PTHREAD_COND_INITIALIZER }
+#endif
+
+typedef int (*ThreadFunc)(void* data);
+
+bool thr_create(Thread* thread, ThreadFunc func, void* data);
+void thr_join(Thread thread);
+
+unsigned thr_cpuCount();
+// Gives the rest of the time slice to another thread
+void thr_yield();
+// Seconds since an arbitrary start, for timing
+double thr_time();
+
+// Storage with one copy per thread, constant initializers only
+#ifdef _WIN32
+#define THR_LOCAL __declspec(thread)
+#else
+#define THR_LOCAL __thread
+#endif
+
+void thr_mutexLock(Mutex* mutex);
+void thr_mutexUnlock(Mutex* mutex);
+
+// mutex must be locked, it is released while waiting and held again on return
+void thr_condWait(Cond* cond, Mutex* mutex);
+void thr_condSignal(Cond* cond);
+void thr_condBroadcast(Cond* cond);
+
+// Returns the value after the add
+long thr_atomicAdd(volatile long* value, long amount);
+long thr_atomicLoad(volatile long* value);
+void thr_atomicStore(volatile long* value, long newValue);
+// Sets value to desired if it holds expected, returns whether it did
+bool thr_atomicCas(volatile long* value, long expected, long desired);
+
+// Bounded lock-free queue of fixed size items, any number of threads can
+// push and pop at once. After Vyukov's bounded MPMC queue, every cell
+// carries a sequence number that says whose turn it is
+typedef struct Queue
+{
+	unsigned char* cells;
+	size_t cellSize;
+	size_t itemSize;
+	long mask; // capacity - 1, the capacity is a power of two
+	volatile long pushPos;
+	volatile long popPos;
+} Queue;
+
+// Room for at least capacity items
+bool thr_queueCreate(Queue* queue, size_t capacity, size_t itemSize);
+void thr_queueDestroy(Queue* queue);
+// Both return false instead of waiting, when full or empty
+bool thr_queuePush(Queue* queue, const void* item);
+bool thr_queuePop(Queue* queue, void* item);
+// Only exact while nobody pushes or pops
+size_t thr_queueCount(Queue* queue);
\ No newline at end of file
@@ -1,5 +1,6 @@
 #pragma once
 #include <math.h>
+#include <stdint.h>
 
 static const float PI = 3.1415f;
 
@@ -115,6 +116,36 @@ static float clampf(float min, float value, float max)
 	return fmaxf(fminf(value, max), min);
 }
 
+// Maps [0, 1] onto the full range of an unsigned normalized integer
+static uint16_t toUnorm16(float value)
+{
+	return (uint16_t)(clampf(0.f, value, 1.f) * 65535.f + 0.5f);
+}
+
+// Maps [-1, 1] onto a signed normalized integer
+static int16_t toSnorm16(float value)
+{
+	return (int16_t)roundf(clampf(-1.f, value, 1.f) * 32767.f);
+}
+
+// Octahedral encoding of a unit vector with y up, x in the low and z in the
+// high half. The upper hemisphere maps straight onto the square, the lower
+// one is folded into its corners
+static uint32_t octEncode(Vec3f n)
+{
+	float sum = fabsf(n.x) + fabsf(n.y) + fabsf(n.z);
+	float u = n.x / sum;
+	float v = n.z / sum;
+	if (n.y < 0.f)
+	{
+		float fu = (1.f - fabsf(v)) * (u >= 0.f ? 1.f : -1.f);
+		float fv = (1.f - fabsf(u)) * (v >= 0.f ? 1.f : -1.f);
+		u = fu;
+		v = fv;
+	}
+	return (uint16_t)toSnorm16(u) | ((uint32_t)(uint16_t)toSnorm16(v) << 16);
+}
+
 static float lerp(float x, float y, float mix)
 {
 	//mix = clampf(0.f, mix, 1.f);
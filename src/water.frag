@@ -0,0 +1,32 @@
+#version 330 core
+
+in vec3 worldPos;
+out vec4 pixelColor;
+
+uniform vec3 camPos;
+uniform float viewDist;
+uniform float seaLevel;
+// See shader.frag
+uniform float clipDist;
+
+void main()
+{
+	float camDist = length(worldPos.xz - camPos.xz);
+	if (camDist < clipDist)
+		discard;
+
+	vec3 color = vec3(0.0, 0.0, 0.25);
+
+	if (camPos.y < seaLevel)
+	{
+		float depthEffect = clamp((1.0 - (camPos.y / seaLevel)) * 0.8 + 0.2, 0.0, 1.0);
+		color = mix(vec3(0.0, 0.0, 0.4), color, depthEffect);
+	}
+
+	float a = 1.0;
+	float viewDistMod = viewDist - 100.0;
+	if (camDist > viewDistMod)
+		a = 1.0 - clamp((camDist - viewDistMod) * 0.01, 0.0, 1.0);
+
+	pixelColor = vec4(color, a);
+}
\ No newline at end of file
@@ -0,0 +1,21 @@
+#version 330 core
+
+out vec3 worldPos;
+
+uniform mat4 projMat;
+uniform mat4 viewMat;
+uniform vec3 camPos;
+uniform float viewDist;
+uniform float seaLevel;
+
+void main()
+{
+	// One quad following the camera, corners come from the strip index
+	vec2 corner = vec2(
+		(gl_VertexID & 1) != 0 ? 1.0 : -1.0,
+		(gl_VertexID & 2) != 0 ? -1.0 : 1.0);
+
+	worldPos = vec3(camPos.x + corner.x * viewDist, seaLevel, camPos.z + corner.y * viewDist);
+
+	gl_Position = projMat * viewMat * vec4(worldPos - camPos, 1.0);
+}
\ No newline at end of file
@@ -0,0 +1,1000 @@
+#include "world.h"
+#include "jobs.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+
+// The table follows the camera once it's this far, in chunks, past the
+// edge of the centre chunk, so walking along a boundary doesn't keep
+// regenerating the same rows
+static const float recenterSlack = 0.25f;
+// Priority of a build straight behind the camera relative to one in view
+static const float behindWeight = 0.2f;
+// The table leads the camera along its velocity by at most this fraction
+// of its size, the chunks behind the camera still have to be in it
+static const float maxLead = 0.125f;
+// Floors are lifted once the detail they held back fits under this
+// fraction of gpuBudget, so a lifted floor doesn't push it over again
+static const float budgetRelease = 0.9f;
+
+static void chunkCenter(const World* world, size_t i, float* x, float* z)
+{
+	*x = world->chunks[i].x * CHUNK_WORLD_SIZE;
+	*z = world->chunks[i].z * CHUNK_WORLD_SIZE;
+}
+
+// Chunk coordinate a slot holds for a table starting at origin
+static int slotCoord(int slot, int origin, int size)
+{
+	return origin + ((slot - origin) % size + size) % size;
+}
+
+static unsigned errorLevel(unsigned cells)
+{
+	unsigned level = 0;
+	while ((1u << level) < cells && level + 1 < MESH_ERROR_LEVELS)
+		level++;
+	return level;
+}
+
+// Pixels covered by one render unit one unit in front of the camera
+static float pixelsPerUnit(float fov)
+{
+	return glh_height / (2.f * tanf(toRad(fov) / 2.f));
+}
+
+// Coarsest lod whose error stays within maxPixels, scale is pixelsPerUnit
+// over the distance from the camera to the chunk's bounds
+static int screenSpaceLod(const Chunk* chunk, float scale, float maxPixels)
+{
+	for (int lod = WORLD_COARSEST_LOD; lod > 1; lod--)
+		if (chunk->lodError[errorLevel(lodCells(lod))] * scale <= maxPixels)
+			return lod;
+	return 1;
+}
+
+static float chunkScreenScale(const World* world, size_t i, Vec3f camPos, float fov)
+{
+	const Chunk* chunk = &world->chunks[i];
+	float x, z;
+	chunkCenter(world, i, &x, &z);
+
+	float half = CHUNK_WORLD_SIZE * 0.5f;
+	float dx = fmaxf(fabsf(x - camPos.x) - half, 0.f);
+	float dz = fmaxf(fabsf(z - camPos.z) - half, 0.f);
+	float dy = fmaxf(camPos.y - chunk->model.maxHeight, 0.f);
+	float dist = sqrtf(dx * dx + dy * dy + dz * dz);
+
+	// Inside the bounds the finest lod always wins
+	return pixelsPerUnit(fov) / fmaxf(dist, 0.001f);
+}
+
+// Errors from a finer grid are closer to the truth, a coarser rebuild
+// doesn't overwrite them
+static void updateErrors(Chunk* chunk, const Mesh* mesh)
+{
+	unsigned cells = mesh->gridSize - 1;
+	if (cells < chunk->errorCells)
+		return;
+
+	memcpy(chunk->lodError, mesh->lodError, sizeof(chunk->lodError));
+	chunk->errorCells = cells;
+}
+
+static bool buildChunk(World* world, int x, int z, int lod, Mesh* mesh, Arena* scratch, volatile long* cancel)
+{
+	if (world->cache && cache_load(world->cache, mesh, x, z, lod, world->mode, world->maxError))
+		return true;
+	if (!buildChunkMesh(mesh, scratch, (float)x, (float)z, lod, world->mode, world->maxError, cancel))
+		return false;
+	if (world->cache)
+		cache_store(world->cache, mesh, x, z, lod, world->mode, world->maxError);
+	return true;
+}
+
+// The build queue is a binary heap, holes first and then the highest
+// priority
+static bool before(const ChunkBuild* a, const ChunkBuild* b)
+{
+	if (a->hole != b->hole)
+		return a->hole;
+	return a->priority > b->priority;
+}
+
+static void swapBuilds(ChunkBuild* a, ChunkBuild* b)
+{
+	ChunkBuild t = *a;
+	*a = *b;
+	*b = t;
+}
+
+static void siftDown(ChunkBuild* heap, size_t count, size_t i)
+{
+	while (true)
+	{
+		size_t first = i;
+		size_t left = i * 2 + 1;
+		size_t right = left + 1;
+		if (left < count && before(&heap[left], &heap[first]))
+			first = left;
+		if (right < count && before(&heap[right], &heap[first]))
+			first = right;
+		if (first == i)
+			return;
+
+		swapBuilds(&heap[i], &heap[first]);
+		i = first;
+	}
+}
+
+static void heapPush(ChunkBuild* heap, size_t* count, const ChunkBuild* build)
+{
+	size_t i = (*count)++;
+	heap[i] = *build;
+	while (i > 0 && before(&heap[i], &heap[(i - 1) / 2]))
+	{
+		swapBuilds(&heap[i], &heap[(i - 1) / 2]);
+		i = (i - 1) / 2;
+	}
+}
+
+// What a build job needs, its chunk is off the queue by the time it runs
+typedef struct BuildJob
+{
+	World* world;
+	volatile long* cancel; // the slot's flag in World.cancel
+	size_t chunk;
+	int x, z;
+	int lod;
+	bool hole;
+} BuildJob;
+
+// Takes the best queued build if fewer than builderCount are running.
+// Called with the lock held
+static bool takeBuild(World* world, BuildJob* data)
+{
+	if (world->queueCount == 0 || world->active >= world->builderCount)
+		return false;
+
+	ChunkBuild* top = &world->queue[0];
+	data->world = world;
+	data->cancel = &world->cancel[top->chunk];
+	data->chunk = top->chunk;
+	data->x = top->x;
+	data->z = top->z;
+	data->lod = top->lod;
+	data->hole = top->hole;
+	world->cancel[top->chunk] = 0;
+
+	world->queue[0] = world->queue[--world->queueCount];
+	siftDown(world->queue, world->queueCount, 0);
+	world->active++;
+	return true;
+}
+
+static void buildJob(Job* job, unsigned worker)
+{
+	BuildJob data;
+	memcpy(&data, job->data, sizeof(data));
+	World* world = data.world;
+
+	ChunkBuild build;
+	memset(&build, 0, sizeof(ChunkBuild));
+	build.chunk = data.chunk;
+	build.x = data.x;
+	build.z = data.z;
+	build.lod = data.lod;
+	build.hole = data.hole;
+
+	double start = thr_time();
+	if (!buildChunk(world, data.x, data.z, data.lod, &build.mesh, &world->scratch[worker], data.cancel))
+		build.cancelled = thr_atomicLoad(data.cancel) != 0;
+	build.buildMs = (float)((thr_time() - start) * 1000.0);
+
+	// Never full, there's at most one build per chunk in flight
+	thr_queuePush(&world->finished, &build);
+
+	// The next build starts right away rather than on the next
+	// world_update. It counts as active before the lock is let go, so the
+	// world can't go away under it
+	thr_mutexLock(&world->lock);
+	world->active--;
+	thr_condBroadcast(&world->idle);
+	bool next = takeBuild(world, &data);
+	thr_mutexUnlock(&world->lock);
+
+	if (next)
+		job_runBackground(job_create(NULL, buildJob, &data, sizeof(data)));
+}
+
+// Starts build jobs until builderCount run
+static void launchBuilds(World* world)
+{
+	while (true)
+	{
+		BuildJob data;
+		thr_mutexLock(&world->lock);
+		bool launch = takeBuild(world, &data);
+		thr_mutexUnlock(&world->lock);
+		if (!launch)
+			return;
+
+		job_runBackground(job_create(NULL, buildJob, &data, sizeof(data)));
+	}
+}
+
+static int uploaderThread(void* data)
+{
+	World* world = data;
+	world->makeCurrent(world->uploadContext);
+
+	thr_mutexLock(&world->lock);
+	while (!world->quit)
+	{
+		// Builders signal idle after every push, popping under the lock
+		// means no push goes unnoticed
+		ChunkBuild build;
+		if (!thr_queuePop(&world->finished, &build))
+		{
+			thr_condWait(&world->idle, &world->lock);
+			continue;
+		}
+		world->uploading++;
+		thr_mutexUnlock(&world->lock);
+
+		if (build.mesh.block)
+		{
+			build.model = glh_uploadModel(&build.mesh);
+			freeMesh(&build.mesh);
+			// Flushed, or the fence might never reach the GPU while the
+			// main thread waits for it
+			build.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+			glFlush();
+		}
+		thr_queuePush(&world->uploaded, &build);
+
+		thr_mutexLock(&world->lock);
+		world->uploading--;
+		thr_condBroadcast(&world->idle);
+	}
+	thr_mutexUnlock(&world->lock);
+
+	world->makeCurrent(NULL);
+	return 0;
+}
+
+bool world_create(World* world, int size, MeshMode mode, float maxError)
+{
+	memset(world, 0, sizeof(World));
+	world->size = size;
+	world->mode = mode;
+	world->maxError = maxError;
+	world->pixelError = 1.f;
+	world->lodHysteresis = 0.25f;
+	world->prefetchSeconds = 2.f;
+	world->lock = (Mutex)MUTEX_INIT;
+	world->idle = (Cond)COND_INIT;
+
+	size_t chunkCount = (size_t)size * size;
+	world->chunks = calloc(chunkCount, sizeof(Chunk));
+	world->queue = malloc(sizeof(ChunkBuild) * chunkCount);
+	world->ratings = malloc(sizeof(ChunkRating) * chunkCount);
+	world->inQueue = malloc(sizeof(bool) * chunkCount);
+	world->cancel = calloc(chunkCount, sizeof(long));
+	world->ages = malloc(sizeof(ChunkAge) * chunkCount);
+
+	// Scratch memory stays with its worker between builds, after the first
+	// load rebuilding a chunk costs no heap allocations
+	world->scratch = calloc(job_workerCount(), sizeof(Arena));
+
+	world->uploadBudget = 2 << 20;
+	bool finished = thr_queueCreate(&world->finished, chunkCount, sizeof(ChunkBuild));
+
+	if (!world->chunks || !world->queue || !finished || !world->ratings || !world->inQueue || !world->cancel || !world->ages ||
+		!world->scratch)
+	{
+		world_destroy(world);
+		return false;
+	}
+
+	// Rebuilds run as background jobs on every worker but the render thread
+	world->builderCount = job_workerCount() - 1;
+	return true;
+}
+
+bool world_startUploader(World* world, ContextFunc makeCurrent, void* context)
+{
+	if (world->hasUploader || !world->builderCount)
+		return false;
+
+	size_t chunkCount = (size_t)world->size * world->size;
+	if (!thr_queueCreate(&world->uploaded, chunkCount, sizeof(ChunkBuild)))
+		return false;
+
+	world->makeCurrent = makeCurrent;
+	world->uploadContext = context;
+	if (!thr_create(&world->uploader, uploaderThread, world))
+	{
+		thr_queueDestroy(&world->uploaded);
+		return false;
+	}
+	world->hasUploader = true;
+	return true;
+}
+
+static void freeBuild(ChunkBuild* build)
+{
+	freeMesh(&build->mesh);
+	if (build->fence)
+		glDeleteSync(build->fence);
+	glh_deleteModel(build->model);
+}
+
+// Drops queued builds and waits for running ones and their uploads, only
+// the main thread touches the world afterwards
+static void cancelBuilds(World* world)
+{
+	size_t chunkCount = (size_t)world->size * world->size;
+
+	ChunkBuild build;
+	thr_mutexLock(&world->lock);
+	world->queueCount = 0;
+	while (world->active > 0 || world->uploading > 0)
+		thr_condWait(&world->idle, &world->lock);
+	// The uploader only pops under the lock
+	while (thr_queuePop(&world->finished, &build))
+		freeBuild(&build);
+	thr_mutexUnlock(&world->lock);
+
+	if (world->hasUploader)
+		while (thr_queuePop(&world->uploaded, &build))
+			freeBuild(&build);
+	if (world->hasDeferred)
+		freeBuild(&world->deferred);
+	world->hasDeferred = false;
+
+	for (size_t i = 0; i < chunkCount; i++)
+		world->chunks[i].buildLod = 0;
+}
+
+void world_destroy(World* world)
+{
+	size_t chunkCount = (size_t)world->size * world->size;
+
+	if (world->builderCount)
+	{
+		cancelBuilds(world);
+
+		thr_mutexLock(&world->lock);
+		world->quit = true;
+		thr_condBroadcast(&world->idle);
+		thr_mutexUnlock(&world->lock);
+
+		if (world->hasUploader)
+			thr_join(world->uploader);
+	}
+
+	if (world->chunks)
+		for (size_t i = 0; i < chunkCount; i++)
+			glh_deleteModel(world->chunks[i].model);
+
+	if (world->scratch)
+		for (unsigned i = 0; i < job_workerCount(); i++)
+			arena_free(&world->scratch[i]);
+
+	free(world->chunks);
+	free(world->queue);
+	thr_queueDestroy(&world->finished);
+	thr_queueDestroy(&world->uploaded);
+	free(world->ratings);
+	free(world->inQueue);
+	free((void*)world->cancel);
+	free(world->ages);
+	free(world->scratch);
+	memset(world, 0, sizeof(World));
+}
+
+
+typedef struct WorldLoad
+{
+	World* world;
+	Mesh* meshes;
+} WorldLoad;
+
+static void loadChunk(size_t i, unsigned worker, void* data)
+{
+	WorldLoad* load = data;
+	Chunk* chunk = &load->world->chunks[i];
+	if (chunk->buildLod)
+		buildChunk(load->world, chunk->x, chunk->z, chunk->buildLod, &load->meshes[i], &load->world->scratch[worker], NULL);
+	else
+		memset(&load->meshes[i], 0, sizeof(Mesh));
+}
+
+// Builds every chunk with a buildLod and swaps its model
+static void loadPass(World* world, WorldLoad* load)
+{
+	size_t chunkCount = (size_t)world->size * world->size;
+
+	// Noise, meshing and optimization run on every core, only the upload needs the GL thread
+	job_parallelFor(chunkCount, loadChunk, load);
+
+	for (size_t i = 0; i < chunkCount; i++)
+	{
+		Chunk* chunk = &world->chunks[i];
+		if (load->meshes[i].block)
+		{
+			glh_deleteModel(chunk->model);
+			chunk->model = glh_loadModel(&load->meshes[i]);
+			chunk->lod = chunk->buildLod;
+			updateErrors(chunk, &load->meshes[i]);
+			freeMesh(&load->meshes[i]);
+		}
+		chunk->buildLod = 0;
+	}
+}
+
+void world_load(World* world, MeshMode mode, Vec3f camPos, float camYaw, float fov)
+{
+	size_t chunkCount = (size_t)world->size * world->size;
+
+	// Build jobs read the mode, a mesh built in the old one would be
+	// cached under the new one
+	cancelBuilds(world);
+	world->mode = mode;
+
+	WorldLoad load = { 0 };
+	load.world = world;
+	load.meshes = malloc(sizeof(Mesh) * chunkCount);
+	if (!load.meshes)
+		return;
+
+	world->originX = (int)floorf(camPos.x / CHUNK_WORLD_SIZE + 0.5f) - world->size / 2;
+	world->originZ = (int)floorf(camPos.z / CHUNK_WORLD_SIZE + 0.5f) - world->size / 2;
+
+	// The coarsest grid is enough to draw and to measure the errors the
+	// refinement starts from
+	for (size_t i = 0; i < chunkCount; i++)
+	{
+		Chunk* chunk = &world->chunks[i];
+		glh_deleteModel(chunk->model);
+		memset(chunk, 0, sizeof(Chunk));
+		chunk->x = slotCoord((int)(i % world->size), world->originX, world->size);
+		chunk->z = slotCoord((int)(i / world->size), world->originZ, world->size);
+		chunk->buildLod = WORLD_COARSEST_LOD;
+	}
+	loadPass(world, &load);
+
+	// Without builders nothing refines in the background, so it happens here
+	if (!world->builderCount)
+	{
+		for (size_t i = 0; i < chunkCount; i++)
+		{
+			Chunk* chunk = &world->chunks[i];
+			int lod = screenSpaceLod(chunk, chunkScreenScale(world, i, camPos, fov), world->pixelError);
+			if (lodCells(lod) != lodCells(chunk->lod))
+				chunk->buildLod = lod;
+		}
+		loadPass(world, &load);
+	}
+
+	free(load.meshes);
+
+	world_update(world, camPos, vec3f(0.f, 0.f, 0.f), camYaw, fov);
+}
+
+// Moves the table's centre to center and hands the slots of chunks that
+// left the table to the ones that entered it. Their builds already queued
+// are pointed at the new chunk, running ones are cancelled
+static void recenter(World* world, Vec3f center)
+{
+	size_t chunkCount = (size_t)world->size * world->size;
+	int half = world->size / 2;
+
+	float camX = center.x / CHUNK_WORLD_SIZE;
+	float camZ = center.z / CHUNK_WORLD_SIZE;
+	if (fabsf(camX - (world->originX + half)) <= 0.5f + recenterSlack &&
+		fabsf(camZ - (world->originZ + half)) <= 0.5f + recenterSlack)
+		return;
+
+	world->originX = (int)floorf(camX + 0.5f) - half;
+	world->originZ = (int)floorf(camZ + 0.5f) - half;
+
+	thr_mutexLock(&world->lock);
+	for (size_t i = 0; i < chunkCount; i++)
+	{
+		Chunk* chunk = &world->chunks[i];
+		int x = slotCoord((int)(i % world->size), world->originX, world->size);
+		int z = slotCoord((int)(i / world->size), world->originZ, world->size);
+		if (chunk->x == x && chunk->z == z)
+			continue;
+
+		glh_deleteModel(chunk->model);
+		int buildLod = chunk->buildLod;
+		memset(chunk, 0, sizeof(Chunk));
+		chunk->x = x;
+		chunk->z = z;
+		chunk->buildLod = buildLod;
+		thr_atomicStore(&world->cancel[i], 1);
+		world->recycled++;
+	}
+
+	for (size_t i = 0; i < world->queueCount; i++)
+	{
+		ChunkBuild* build = &world->queue[i];
+		Chunk* chunk = &world->chunks[build->chunk];
+		if (build->x == chunk->x && build->z == chunk->z)
+			continue;
+
+		build->x = chunk->x;
+		build->z = chunk->z;
+		build->lod = WORLD_COARSEST_LOD;
+		build->hole = true;
+		chunk->buildLod = WORLD_COARSEST_LOD;
+	}
+	thr_mutexUnlock(&world->lock);
+}
+
+// Next build to swap in from queue, the deferred one first
+static bool nextBuild(World* world, Queue* queue, ChunkBuild* build)
+{
+	if (!world->hasDeferred)
+		return thr_queuePop(queue, build);
+
+	*build = world->deferred;
+	world->hasDeferred = false;
+	return true;
+}
+
+static void deferBuild(World* world, const ChunkBuild* build)
+{
+	world->deferred = *build;
+	world->hasDeferred = true;
+}
+
+// A build that came back for nothing
+static void dropBuild(World* world, Chunk* chunk, ChunkBuild* build)
+{
+	chunk->buildLod = 0;
+	world->buildMs += build->buildMs;
+	world->wastedMs += build->buildMs;
+	if (build->cancelled)
+		world->cancelledRunning++;
+	else
+		world->discarded++;
+	freeBuild(build);
+}
+
+static void swapModel(World* world, Chunk* chunk, const ChunkBuild* build, Model model)
+{
+	if (chunk->late)
+		world->popIns++;
+	chunk->late = false;
+	world->buildMs += build->buildMs;
+	glh_deleteModel(chunk->model);
+	chunk->model = model;
+	chunk->lod = build->lod;
+	chunk->buildLod = 0;
+	updateErrors(chunk, &build->mesh);
+	world->rebuilds++;
+}
+
+// Uploads are what the main thread pays for, they stop at the budget and
+// the rest waits in the queue
+static void uploadFinished(World* world)
+{
+	ChunkBuild build;
+	while (nextBuild(world, &world->finished, &build))
+	{
+		Chunk* chunk = &world->chunks[build.chunk];
+		if (build.x != chunk->x || build.z != chunk->z || !build.mesh.block)
+		{
+			dropBuild(world, chunk, &build);
+			continue;
+		}
+
+		if (world->uploadBytes > 0 && world->uploadBytes + build.mesh.blockSize > world->uploadBudget)
+		{
+			deferBuild(world, &build);
+			break;
+		}
+
+		swapModel(world, chunk, &build, glh_loadModel(&build.mesh));
+		world->uploadBytes += build.mesh.blockSize;
+		freeMesh(&build.mesh);
+	}
+}
+
+// The uploader's buffers are only drawn once their fence has signalled,
+// taken in order so one slow upload holds back the ones after it
+static void takeUploads(World* world)
+{
+	ChunkBuild build;
+	while (nextBuild(world, &world->uploaded, &build))
+	{
+		if (build.fence)
+		{
+			if (glClientWaitSync(build.fence, 0, 0) == GL_TIMEOUT_EXPIRED)
+			{
+				deferBuild(world, &build);
+				break;
+			}
+			glDeleteSync(build.fence);
+			build.fence = NULL;
+		}
+
+		Chunk* chunk = &world->chunks[build.chunk];
+		if (build.x != chunk->x || build.z != chunk->z || !build.model.vbo)
+		{
+			dropBuild(world, chunk, &build);
+			continue;
+		}
+
+		glh_bindModel(&build.model);
+		swapModel(world, chunk, &build, build.model);
+		world->uploadBytes += build.model.gpuBytes;
+	}
+}
+
+// 1 inside the view cone the chunks are drawn in, falling to behindWeight
+// straight behind the camera
+static float facingWeight(float x, float z, Vec3f camPos, float camYaw, float fov)
+{
+	// The cone's apex is a chunk behind the camera, like the draw loop's
+	float pX = camPos.x + sinf(toRad(camYaw)) * CHUNK_WORLD_SIZE;
+	float pZ = camPos.z + cosf(toRad(camYaw)) * CHUNK_WORLD_SIZE;
+	float angleDiff = fabsf(fmodf(camYaw - toDeg(fastAtan2(pX - x, pZ - z)) + 180.f + 360.f, 360.f) - 180.f);
+
+	float cone = fov * 0.667f;
+	if (angleDiff <= cone)
+		return 1.f;
+	return 1.f + (behindWeight - 1.f) * (angleDiff - cone) / fmaxf(180.f - cone, 1.f);
+}
+
+static bool keepsCells(const ChunkRating* rating, unsigned cells)
+{
+	return cells <= rating->finest && cells >= rating->coarsest;
+}
+
+// Where the camera is headed prefetchSeconds from now, at most maxLead
+// of the table away
+static Vec3f predictCamera(const World* world, Vec3f camPos, Vec3f camVel)
+{
+	float t = world->prefetchSeconds;
+	float lead = sqrtf(camVel.x * camVel.x + camVel.z * camVel.z) * t;
+	float maxDist = maxLead * world->size * CHUNK_WORLD_SIZE;
+	if (lead > maxDist)
+		t *= maxDist / lead;
+	return vec3f(camPos.x + camVel.x * t, camPos.y + camVel.y * t, camPos.z + camVel.z * t);
+}
+
+// Rated from wherever the camera is or will be nearer to the chunk, so the
+// detail along the way is built before the camera gets there
+static void rateChunk(World* world, size_t i, Vec3f camPos, Vec3f ahead, float camYaw, float fov, ChunkRating* rating)
+{
+	Chunk* chunk = &world->chunks[i];
+	float x, z;
+	chunkCenter(world, i, &x, &z);
+	float nowScale = chunkScreenScale(world, i, camPos, fov);
+	float nowWeight = facingWeight(x, z, camPos, camYaw, fov);
+	float scale = fmaxf(nowScale, chunkScreenScale(world, i, ahead, fov));
+	float weight = fmaxf(nowWeight, facingWeight(x, z, ahead, camYaw, fov));
+	memset(rating, 0, sizeof(ChunkRating));
+
+	bool visible = nowWeight >= 1.f;
+	if (visible)
+		chunk->lastVisible = world->frame;
+
+	// A hole in the terrain beats any error, the nearest first
+	if (!chunk->model.vao)
+	{
+		chunk->late = visible;
+		rating->needed = true;
+		rating->hole = true;
+		rating->lod = WORLD_COARSEST_LOD;
+		rating->priority = scale * weight;
+		return;
+	}
+
+	// Keep the current grid while it lies between the lods picked with
+	// a looser and a stricter threshold
+	unsigned cells = lodCells(chunk->lod);
+	rating->finest = lodCells(screenSpaceLod(chunk, scale, world->pixelError / (1.f + world->lodHysteresis)));
+	rating->coarsest = lodCells(screenSpaceLod(chunk, scale, world->pixelError * (1.f + world->lodHysteresis)));
+	rating->lod = screenSpaceLod(chunk, scale, world->pixelError);
+	rating->priority = chunk->lodError[errorLevel(cells)] * scale * weight;
+
+	if (chunk->lodFloor)
+	{
+		rating->lod = max(rating->lod, chunk->lodFloor);
+		rating->finest = min(rating->finest, lodCells(chunk->lodFloor));
+		rating->coarsest = min(rating->coarsest, rating->finest);
+		// Downgrades give memory back, they go before any refinement
+		if (cells > rating->finest)
+			rating->priority = FLT_MAX;
+	}
+
+	// lods that share a grid size would rebuild the same mesh
+	rating->needed = !keepsCells(rating, cells) && lodCells(rating->lod) != cells;
+
+	// Pop-in is judged from where the camera is now, whatever was prefetched
+	unsigned visibleCells = lodCells(screenSpaceLod(chunk, nowScale, world->pixelError * (1.f + world->lodHysteresis)));
+	if (chunk->lodFloor)
+		visibleCells = min(visibleCells, lodCells(chunk->lodFloor));
+	chunk->late = visible && cells < visibleCells;
+}
+
+// Queued builds take the lod and priority of their chunk's new rating, and
+// the ones whose chunk is fine again are dropped. Called with the lock held
+static void reprioritize(World* world)
+{
+	size_t i = 0;
+	while (i < world->queueCount)
+	{
+		ChunkBuild* build = &world->queue[i];
+		Chunk* chunk = &world->chunks[build->chunk];
+		const ChunkRating* rating = &world->ratings[build->chunk];
+		if (!rating->needed)
+		{
+			chunk->buildLod = 0;
+			world->cancelledQueued++;
+			*build = world->queue[--world->queueCount];
+			continue;
+		}
+
+		build->lod = rating->lod;
+		build->priority = rating->priority;
+		build->hole = rating->hole;
+		chunk->buildLod = rating->lod;
+		world->inQueue[build->chunk] = true;
+		i++;
+	}
+
+	for (size_t i = world->queueCount / 2; i-- > 0;)
+		siftDown(world->queue, world->queueCount, i);
+}
+
+// Running builds whose mesh would be replaced as soon as it arrived give
+// up, their chunk is queued again once the builder hands them back. Called
+// with the lock held
+static void cancelStale(World* world)
+{
+	size_t chunkCount = (size_t)world->size * world->size;
+	for (size_t i = 0; i < chunkCount; i++)
+	{
+		const Chunk* chunk = &world->chunks[i];
+		if (!chunk->buildLod || world->inQueue[i] || !chunk->model.vao)
+			continue;
+
+		const ChunkRating* rating = &world->ratings[i];
+		if (!rating->needed || !keepsCells(rating, lodCells(chunk->buildLod)))
+			thr_atomicStore(&world->cancel[i], 1);
+	}
+}
+
+static size_t arenaBytes(const Arena* arenas, unsigned count)
+{
+	size_t bytes = 0;
+	for (unsigned i = 0; arenas && i < count; i++)
+		bytes += arenas[i].size;
+	return bytes;
+}
+
+static void trackMemory(World* world)
+{
+	size_t chunkCount = (size_t)world->size * world->size;
+
+	world->gpuBytes = 0;
+	for (size_t i = 0; i < chunkCount; i++)
+		world->gpuBytes += world->chunks[i].model.gpuBytes;
+
+	size_t tables = chunkCount * (sizeof(Chunk) + sizeof(ChunkBuild) * 3 + sizeof(ChunkRating) + sizeof(ChunkAge) +
+		sizeof(bool) + sizeof(long));
+	size_t arenas = arenaBytes(world->scratch, job_workerCount());
+	world->cpuBytes = tables + arenas + pool_liveBytes() + pool_cachedBytes();
+	if (!world->cpuBudget || world->cpuBytes <= world->cpuBudget)
+		return;
+
+	// Scratch grows back with the next build, it can only go while no
+	// build job uses it. New ones only start under the lock
+	thr_mutexLock(&world->lock);
+	if (world->active == 0)
+		for (unsigned i = 0; i < job_workerCount(); i++)
+			arena_free(&world->scratch[i]);
+	thr_mutexUnlock(&world->lock);
+
+	size_t excess = world->cpuBytes - world->cpuBudget;
+	size_t cached = pool_cachedBytes();
+	pool_trim(cached > excess ? cached - excess : 0);
+
+	arenas = arenaBytes(world->scratch, job_workerCount());
+	world->cpuBytes = tables + arenas + pool_liveBytes() + pool_cachedBytes();
+}
+
+static int compareAge(const void* a, const void* b)
+{
+	const ChunkAge* ca = a;
+	const ChunkAge* cb = b;
+	if (ca->lastVisible != cb->lastVisible)
+		return ca->lastVisible < cb->lastVisible ? -1 : 1;
+	return (ca->distance < cb->distance) - (ca->distance > cb->distance);
+}
+
+// Least recently visible chunks are floored at the coarsest lod until
+// the models still waiting for their downgrade would bring gpuBytes under
+// gpuBudget. With room again the most recently visible get their detail
+// back, as long as the model they had before fits
+static void applyBudget(World* world, Vec3f camPos)
+{
+	if (!world->gpuBudget)
+		return;
+
+	size_t chunkCount = (size_t)world->size * world->size;
+	size_t count = 0;
+	size_t pending = 0;
+	for (size_t i = 0; i < chunkCount; i++)
+	{
+		const Chunk* chunk = &world->chunks[i];
+		if (!chunk->model.vao)
+			continue;
+		if (chunk->lodFloor && chunk->lod < chunk->lodFloor)
+			pending += chunk->model.gpuBytes;
+
+		float x, z;
+		chunkCenter(world, i, &x, &z);
+		ChunkAge* age = &world->ages[count++];
+		age->lastVisible = chunk->lastVisible;
+		age->distance = pow2f(x - camPos.x) + pow2f(z - camPos.z);
+		age->chunk = i;
+	}
+	qsort(world->ages, count, sizeof(ChunkAge), compareAge);
+
+	if (world->gpuBytes > world->gpuBudget)
+	{
+		size_t excess = world->gpuBytes - world->gpuBudget;
+		for (size_t i = 0; i < count && pending < excess; i++)
+		{
+			Chunk* chunk = &world->chunks[world->ages[i].chunk];
+			if (chunk->lodFloor || lodCells(chunk->lod) <= lodCells(WORLD_COARSEST_LOD))
+				continue;
+
+			chunk->lodFloor = WORLD_COARSEST_LOD;
+			chunk->floorBytes = chunk->model.gpuBytes;
+			pending += chunk->model.gpuBytes;
+			world->downgraded++;
+		}
+		return;
+	}
+
+	size_t release = (size_t)(world->gpuBudget * budgetRelease);
+	size_t room = release > world->gpuBytes ? release - world->gpuBytes : 0;
+	for (size_t i = count; i-- > 0;)
+	{
+		Chunk* chunk = &world->chunks[world->ages[i].chunk];
+		if (!chunk->lodFloor)
+			continue;
+		if (chunk->floorBytes > room)
+			break;
+
+		room -= chunk->floorBytes;
+		chunk->lodFloor = 0;
+	}
+}
+
+// Without builders every chunk the ratings ask for is built right away,
+// like world_load does. Holes get the coarsest lod and are refined by the
+// next call, once their errors are known
+static void buildInPlace(World* world)
+{
+	size_t chunkCount = (size_t)world->size * world->size;
+	for (size_t i = 0; i < chunkCount; i++)
+		if (world->ratings[i].needed)
+		{
+			world->chunks[i].buildLod = world->ratings[i].lod;
+			world->queued++;
+		}
+	if (!world->queued)
+		return;
+
+	WorldLoad load = { 0 };
+	load.world = world;
+	load.meshes = malloc(sizeof(Mesh) * chunkCount);
+	if (!load.meshes)
+	{
+		for (size_t i = 0; i < chunkCount; i++)
+			world->chunks[i].buildLod = 0;
+		return;
+	}
+
+	for (size_t i = 0; i < chunkCount; i++)
+		if (world->chunks[i].buildLod)
+		{
+			world->rebuilds++;
+			world->popIns += world->chunks[i].late;
+		}
+	loadPass(world, &load);
+	free(load.meshes);
+}
+
+void world_update(World* world, Vec3f camPos, Vec3f camVel, float camYaw, float fov)
+{
+	size_t chunkCount = (size_t)world->size * world->size;
+
+	Vec3f ahead = predictCamera(world, camPos, camVel);
+	recenter(world, ahead);
+
+	world->uploadBytes = 0;
+	if (world->hasUploader)
+		takeUploads(world);
+	else
+		uploadFinished(world);
+
+	world->frame++;
+	trackMemory(world);
+
+	world->queued = 0;
+	applyBudget(world, camPos);
+
+	// Builders never touch the chunks, so they're rated without the lock
+	world->lateChunks = 0;
+	for (size_t i = 0; i < chunkCount; i++)
+	{
+		rateChunk(world, i, camPos, ahead, camYaw, fov, &world->ratings[i]);
+		world->lateChunks += world->chunks[i].late;
+	}
+
+	if (!world->builderCount)
+	{
+		buildInPlace(world);
+		return;
+	}
+
+	memset(world->inQueue, 0, sizeof(bool) * chunkCount);
+
+	thr_mutexLock(&world->lock);
+	reprioritize(world);
+	cancelStale(world);
+
+	for (size_t i = 0; i < chunkCount; i++)
+	{
+		Chunk* chunk = &world->chunks[i];
+		const ChunkRating* rating = &world->ratings[i];
+		if (chunk->buildLod || !rating->needed)
+			continue;
+
+		ChunkBuild build;
+		memset(&build, 0, sizeof(ChunkBuild));
+		build.chunk = i;
+		build.x = chunk->x;
+		build.z = chunk->z;
+		build.lod = rating->lod;
+		build.priority = rating->priority;
+		build.hole = rating->hole;
+		chunk->buildLod = rating->lod;
+		heapPush(world->queue, &world->queueCount, &build);
+		world->queued++;
+	}
+
+	thr_mutexUnlock(&world->lock);
+
+	launchBuilds(world);
+}
+
+bool world_refined(World* world)
+{
+	thr_mutexLock(&world->lock);
+	bool idle = world->queueCount == 0 && world->active == 0 && world->uploading == 0;
+	thr_mutexUnlock(&world->lock);
+	return idle && thr_queueCount(&world->finished) == 0 && thr_queueCount(&world->uploaded) == 0 &&
+		!world->hasDeferred && world->queued == 0;
+}
+
+size_t world_pendingBuilds(World* world)
+{
+	thr_mutexLock(&world->lock);
+	size_t pending = world->queueCount + world->active + world->uploading;
+	thr_mutexUnlock(&world->lock);
+	return pending;
+}
\ No newline at end of file
@@ -0,0 +1,188 @@
+#pragma once
+#include "terrain.h"
+#include "thread.h"
+#include "chunkCache.h"
+
+// Width of a chunk in render units
+#define CHUNK_WORLD_SIZE 20.f
+// Lod every chunk starts at, past it lodCells doesn't get any coarser
+#define WORLD_COARSEST_LOD 8
+
+typedef struct Chunk
+{
+	int x, z; // chunk coordinates, its slot is x and z modulo the table size
+	Model model;
+	int lod;      // lod of model
+	int buildLod; // lod being built in the background, 0 when idle
+	// Per grid size, from the finest mesh built so far, see Mesh
+	float lodError[MESH_ERROR_LEVELS];
+	unsigned errorCells; // grid the errors were measured on
+	unsigned lastVisible; // World.frame it was last inside the view cone
+	int lodFloor; // finest lod the memory budget allows, 0 for any
+	bool late; // in view and missing or too coarse at the last rating
+	size_t floorBytes; // gpuBytes of the model it had before the floor
+} Chunk;
+
+// What world_update wants for a chunk this frame
+typedef struct ChunkRating
+{
+	bool needed; // the current model doesn't fit anymore
+	int lod;
+	float priority;
+	bool hole;
+	// Grid cells a model may have and still be kept, so standing still
+	// doesn't thrash. 0 for holes
+	unsigned finest, coarsest;
+} ChunkRating;
+
+// Slot ordered for the memory budget
+typedef struct ChunkAge
+{
+	unsigned lastVisible;
+	float distance;
+	size_t chunk;
+} ChunkAge;
+
+typedef struct ChunkBuild
+{
+	size_t chunk; // slot, the result is dropped if it holds another chunk by then
+	int x, z;
+	int lod;
+	// Projected error of the chunk's current grid in pixels, weighted down
+	// away from the view direction. Holes come before any error
+	float priority;
+	bool hole; // slot without a model yet
+	Mesh mesh;
+	bool cancelled; // given up halfway, see World.cancel
+	float buildMs;
+	// Filled from mesh by the upload thread, without a vao until it's swapped in
+	Model model;
+	GLsync fence; // signalled once model's buffers are on the GPU
+} ChunkBuild;
+
+// Makes the upload context current on the calling thread, or none for NULL
+typedef void (*ContextFunc)(void* context);
+
+// Square table of chunks centred on the camera. Slots are addressed by
+// chunk coordinate modulo the table size, so when the camera crosses a
+// chunk boundary only the row or column that left the table is recycled
+// for the one that entered it, and memory stays the same however far the
+// camera goes. Each chunk uses the coarsest lod whose geometric error
+// projects to at most pixelError pixels, so rough terrain gets its
+// triangles before flat terrain at the same distance. Rebuilds run as
+// background jobs and a chunk keeps drawing its old model until the new
+// mesh is ready
+typedef struct World
+{
+	Chunk* chunks;
+	int size; // chunks per side
+	int originX, originZ; // chunk coordinates of the table's first corner
+	MeshMode mode; // changed through world_load, build jobs read it
+	float maxError;
+	float pixelError;
+	// How far past pixelError, as a fraction of it, a chunk's projected
+	// error has to be before it is rebuilt, so standing still doesn't thrash
+	float lodHysteresis;
+	// How far ahead the camera's velocity is followed. The table is
+	// centred on where the camera will be and chunks are rated from the
+	// nearer of both positions, 0 streams around the camera only
+	float prefetchSeconds;
+
+	Arena* scratch; // one per job worker, for world_load and build jobs
+	// Optional, meshes found there skip the noise and new ones are added.
+	// Has to stay open until world_destroy
+	ChunkCache* cache;
+	ChunkRating* ratings; // per slot, from the last world_update
+	bool* inQueue; // per slot, scratch for world_update
+	size_t queued; // rebuilds queued by the last world_update
+
+	// Finished builds come back through a lock-free queue, so a build
+	// job never waits on the main thread to hand over a mesh
+	Queue finished;
+	ChunkBuild deferred; // popped past the upload budget, first in line next time
+	bool hasDeferred;
+	size_t uploadBudget; // mesh bytes uploaded per world_update, at least one mesh
+	size_t uploadBytes;  // by the last world_update
+
+	// Optional upload thread, see world_startUploader. It takes over the
+	// finished queue and passes filled buffers on through uploaded
+	Thread uploader;
+	bool hasUploader;
+	ContextFunc makeCurrent;
+	void* uploadContext;
+	Queue uploaded;
+
+	// Builds are handed from the queue to job_runBackground, at most
+	// builderCount at a time, so the most urgent ones are picked as late
+	// as possible. 0 without job workers beside the calling thread, then
+	// world_update builds what it needs itself
+	unsigned builderCount;
+
+	// Everything below is shared with the build jobs and guarded by lock
+	Mutex lock;
+	Cond idle; // a build job or the uploader finished one
+	ChunkBuild* queue; // max-heap on priority, at most one build per chunk
+	size_t queueCount;
+	// Per slot, set to make the running build of that slot give up. Taking
+	// a build off the queue clears its slot's flag
+	volatile long* cancel;
+	unsigned active; // builds taken off the queue and not pushed to finished yet
+	unsigned uploading; // taken off finished by the uploader, not pushed to uploaded yet
+	bool quit;
+
+	size_t rebuilds; // meshes swapped in by world_update
+	// Pop-in, meshes swapped into a chunk while it was in view and missing
+	// or visibly too coarse, and such chunks at the last world_update
+	size_t popIns;
+	size_t lateChunks;
+	size_t recycled; // slots handed to a new chunk
+
+	// Memory budgets in bytes, 0 is unlimited. Over gpuBudget the chunks
+	// seen least recently, farthest first, are held at the coarsest lod
+	// until their detail fits again. Over cpuBudget the mesh pool gives its
+	// spare blocks back and world_load's scratch is freed
+	size_t gpuBudget;
+	size_t cpuBudget;
+	size_t gpuBytes; // of every chunk model, from the last world_update
+	size_t cpuBytes; // tables, scratch arenas and the mesh pool
+	size_t downgraded; // chunks floored by gpuBudget so far
+	unsigned frame; // world_update calls
+	ChunkAge* ages; // scratch for the budget, one per slot
+
+	// Wasted work
+	size_t cancelledQueued;  // dropped before a build job took them
+	size_t cancelledRunning; // given up halfway by their build job
+	size_t discarded;        // finished for a chunk that had left the table
+	double buildMs;  // job time of every build that came back
+	double wastedMs; // of that, spent on builds that were thrown away
+} World;
+
+bool world_create(World* world, int size, MeshMode mode, float maxError);
+void world_destroy(World* world);
+
+// Moves the buffer uploads of rebuilds to a thread of their own, so
+// world_update only swaps in models whose fence has signalled. context is
+// a GL context sharing objects with the drawing one, made current on the
+// upload thread through makeCurrent. On failure uploads stay on the
+// calling thread
+bool world_startUploader(World* world, ContextFunc makeCurrent, void* context);
+
+// Builds every chunk at the coarsest lod on all cores, which takes a few
+// milliseconds, and queues the refinement. Used on start and to change
+// the mode, which is only set once no build job reads it anymore
+void world_load(World* world, MeshMode mode, Vec3f camPos, float camYaw, float fov);
+// Recentres the table on camPos, uploads finished rebuilds up to
+// uploadBudget, or swaps in the uploader's ready ones, and queues new
+// ones for chunks whose lod no longer fits camPos, missing chunks first
+// and then the most visible errors. Queued builds are re-rated every
+// call, the ones no longer needed are dropped and running ones whose
+// result would be replaced straight away are cancelled. camYaw only
+// orders the builds, chunks in view first. camVel is in render units per
+// second, see prefetchSeconds. Never waits on the builders
+void world_update(World* world, Vec3f camPos, Vec3f camVel, float camYaw, float fov);
+
+// Pending and running background builds
+size_t world_pendingBuilds(World* world);
+// Every chunk is at the lod the last world_update wanted and nothing is
+// left to build or swap in
+bool world_refined(World* world);
\ No newline at end of file